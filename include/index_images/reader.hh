@@ -0,0 +1,218 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_READER_HH
+#define INDEX_IMAGES_READER_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <gsl/span>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+
+// Does not use namespaces.
+struct sqlite3;
+struct sqlite3_stmt;
+
+
+// Read-only access to an index created by index_images. Link with libindex_images.a and -lsqlite3.
+namespace index_images {
+	
+	typedef gsl::span <std::byte const>	blob_span;
+	
+	
+	enum class blob_kind : std::uint8_t
+	{
+		PREVIEW,
+		THUMBNAIL
+	};
+	
+	
+	// Filters for image_reader::rows(). Unset values do not restrict the result.
+	struct row_filter
+	{
+		std::optional <std::string>		project;
+		std::optional <std::string>		lens_model;
+		std::optional <std::int64_t>	since;		// Inclusive, UTC.
+		std::optional <std::int64_t>	until;		// Exclusive, UTC.
+		std::optional <std::int32_t>	min_rank;
+		std::optional <std::int64_t>	sequence_id;
+		std::optional <std::int64_t>	limit;
+		std::optional <blob_kind>		blob;		// Also read the preview or the thumbnail.
+	};
+	
+	
+	// The current row of an image_range. The accessors correspond to exif_properties and
+	// dop_properties. The string views and the blob point to SQLite’s buffers and are
+	// valid until the range is advanced.
+	class image_row
+	{
+		friend class image_range;
+		
+	protected:
+		sqlite3_stmt	*m_stmt{};
+		
+	public:
+		std::int64_t id() const;
+		std::string_view project() const;
+		std::string_view filename() const;
+		std::uint64_t timestamp() const;
+		std::int64_t timestamp_us() const;		// UTC, zero if not known.
+		
+		// EXIF.
+		std::string_view artist() const;
+		std::string_view copyright() const;
+		std::string_view make() const;
+		std::string_view model() const;
+		std::string_view lens_model() const;
+		std::string_view body_serial() const;
+		std::string_view lens_serial() const;
+		std::pair <std::uint32_t, std::uint32_t> exposure_time() const;
+		std::uint32_t shutter_count() const;
+		float aperture() const;
+		float focal_length() const;
+		float iso_speed() const;
+		std::uint16_t exposure_program() const;
+		std::uint16_t flash() const;
+		std::uint16_t orientation() const;
+		std::optional <double> gps_latitude() const;		// Degrees, negative in the south.
+		std::optional <double> gps_longitude() const;		// Degrees, negative in the west.
+		std::optional <double> gps_altitude() const;		// Metres, negative below the sea level.
+		
+		// DOP.
+		std::int32_t rank() const;
+		
+		// Exposure statistics.
+		std::optional <double> clipped_fraction() const;
+		std::optional <double> dark_fraction() const;
+		std::optional <double> mean_luminance() const;
+		
+		// Images of the same burst or sequence have the same identifier.
+		std::optional <std::int64_t> sequence_id() const;
+		
+		// Empty unless requested with row_filter::blob.
+		blob_span blob() const;
+		
+	protected:
+		std::string_view text_column(int const idx) const;
+		std::optional <double> real_column(int const idx) const;
+	};
+	
+	
+	// Single-pass range of the rows that match a filter, ordered by timestamp_us.
+	class image_range
+	{
+	public:
+		class iterator
+		{
+		protected:
+			image_range	*m_range{};
+			
+		public:
+			typedef std::input_iterator_tag	iterator_category;
+			typedef image_row				value_type;
+			typedef std::ptrdiff_t			difference_type;
+			typedef image_row const			*pointer;
+			typedef image_row const			&reference;
+			
+			iterator() = default;
+			
+			explicit iterator(image_range &range):
+				m_range(range.m_is_at_end ? nullptr : &range)
+			{
+			}
+			
+			reference operator*() const { return m_range->m_row; }
+			pointer operator->() const { return &m_range->m_row; }
+			iterator &operator++();
+			
+			bool operator==(iterator const &other) const { return m_range == other.m_range; }
+			bool operator!=(iterator const &other) const { return m_range != other.m_range; }
+		};
+		
+		friend class iterator;
+		
+	protected:
+		image_row		m_row;
+		bool			m_is_at_end{true};
+		
+	public:
+		image_range() = default;
+		explicit image_range(sqlite3_stmt *stmt);	// Takes ownership.
+		~image_range();
+		
+		image_range(image_range &&other);
+		image_range &operator=(image_range &&other);
+		
+		iterator begin() { return iterator(*this); }
+		iterator end() { return iterator(); }
+		
+	protected:
+		void step();
+	};
+	
+	
+	class image_reader
+	{
+	protected:
+		sqlite3			*m_db{};
+		sqlite3_stmt	*m_blob_statements[2]{};	// By blob_kind.
+		
+	public:
+		// Open the database read-only. Throws std::runtime_error on failure.
+		explicit image_reader(std::string const &path);
+		~image_reader();
+		
+		image_reader(image_reader const &) = delete;
+		image_reader &operator=(image_reader const &) = delete;
+		
+		image_range rows(row_filter const &filter);
+		
+		// Call fn(id, blob) for each of the given identifiers that has the requested blob, in one
+		// read transaction. The blob is valid until fn returns. The thumbnail is replaced with the
+		// preview for images indexed without one.
+		template <typename t_fn>
+		void fetch_blobs(gsl::span <std::int64_t const> const ids, blob_kind const kind, t_fn &&fn);
+		
+	protected:
+		void begin_read();
+		void end_read();
+		blob_span read_blob(std::int64_t const id, blob_kind const kind);
+		void reset_blob_statements();	// Invalidates the blobs.
+	};
+	
+	
+	template <typename t_fn>
+	void image_reader::fetch_blobs(gsl::span <std::int64_t const> const ids, blob_kind const kind, t_fn &&fn)
+	{
+		begin_read();
+		try
+		{
+			for (auto const id : ids)
+			{
+				auto blob(read_blob(id, kind));
+				if (blob.empty() && blob_kind::THUMBNAIL == kind)
+					blob = read_blob(id, blob_kind::PREVIEW);
+				if (!blob.empty())
+					fn(id, blob);
+				
+				// An active statement would keep the transaction open.
+				reset_blob_statements();
+			}
+		}
+		catch (...)
+		{
+			end_read();
+			throw;
+		}
+		end_read();
+	}
+}
+
+#endif
@@ -0,0 +1,47 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <cstdlib>
+#include <new>
+#include "allocation_counter.hh"
+
+
+#ifdef INDEX_IMAGES_COUNT_ALLOCATIONS
+
+namespace {
+	thread_local std::uint64_t s_allocation_count{};
+}
+
+
+// The other forms of operator new and delete (except for the over-aligned ones, which are
+// not used here) are implemented in terms of these.
+void *operator new(std::size_t size)
+{
+	++s_allocation_count;
+	if (void *retval = std::malloc(size ? size : 1))
+		return retval;
+	throw std::bad_alloc();
+}
+
+
+void operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+#endif
+
+
+namespace index_images {
+	
+	std::uint64_t thread_allocation_count()
+	{
+#ifdef INDEX_IMAGES_COUNT_ALLOCATIONS
+		return s_allocation_count;
+#else
+		return 0;
+#endif
+	}
+}
@@ -0,0 +1,27 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_ALLOCATION_COUNTER_HH
+#define INDEX_IMAGES_ALLOCATION_COUNTER_HH
+
+#include <cstdint>
+
+
+namespace index_images {
+	
+	// Debugging aid for checking that the image processing does not allocate after warm-up.
+	// When built with COUNT_ALLOCATIONS=1, the global operator new is replaced with one that
+	// counts the calls made by each thread.
+#ifdef INDEX_IMAGES_COUNT_ALLOCATIONS
+	constexpr inline bool counts_allocations() { return true; }
+#else
+	constexpr inline bool counts_allocations() { return false; }
+#endif
+	
+	// Number of operator new calls made by the calling thread, or zero if not counted.
+	std::uint64_t thread_allocation_count();
+}
+
+#endif
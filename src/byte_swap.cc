@@ -0,0 +1,102 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <boost/endian/conversion.hpp>
+#include <cstddef>
+#include "byte_swap.hh"
+
+#if defined(__x86_64__) || defined(__i386__)
+#	include <immintrin.h>
+#	define INDEX_IMAGES_HAVE_SSSE3_SWAP 1
+#endif
+
+
+namespace {
+	
+	template <typename t_value>
+	void swap_bytes_scalar(t_value *values, std::size_t const count)
+	{
+		for (std::size_t i(0); i < count; ++i)
+			boost::endian::endian_reverse_inplace(values[i]);
+	}
+
+
+#ifdef INDEX_IMAGES_HAVE_SSSE3_SWAP
+	bool has_ssse3()
+	{
+#ifdef __SSSE3__
+		return true;
+#else
+		static bool const retval(__builtin_cpu_supports("ssse3"));
+		return retval;
+#endif
+	}
+	
+	
+	// Reverse the bytes of each t_size-byte lane of the full 16-byte blocks and return
+	// the number of values handled.
+	template <std::size_t t_size>
+	__attribute__((target("ssse3")))
+	std::size_t swap_bytes_ssse3(void *data, std::size_t const count)
+	{
+		static_assert(2 == t_size || 4 == t_size || 8 == t_size);
+		
+		__m128i mask;
+		if constexpr (2 == t_size)
+			mask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+		else if constexpr (4 == t_size)
+			mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+		else
+			mask = _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8);
+		
+		// The input is not necessarily 16-byte aligned.
+		auto *bytes(static_cast <std::uint8_t *>(data));
+		std::size_t const values_per_block(16 / t_size);
+		std::size_t i(0);
+		for (; i + 2 * values_per_block <= count; i += 2 * values_per_block)
+		{
+			auto *ptr(reinterpret_cast <__m128i *>(bytes + i * t_size));
+			auto const val1(_mm_loadu_si128(ptr));
+			auto const val2(_mm_loadu_si128(ptr + 1));
+			_mm_storeu_si128(ptr, _mm_shuffle_epi8(val1, mask));
+			_mm_storeu_si128(ptr + 1, _mm_shuffle_epi8(val2, mask));
+		}
+		
+		if (i + values_per_block <= count)
+		{
+			auto *ptr(reinterpret_cast <__m128i *>(bytes + i * t_size));
+			_mm_storeu_si128(ptr, _mm_shuffle_epi8(_mm_loadu_si128(ptr), mask));
+			i += values_per_block;
+		}
+		
+		return i;
+	}
+#endif
+	
+	
+	template <typename t_value>
+	void swap_bytes_(gsl::span <t_value> values)
+	{
+		auto *data(values.data());
+		std::size_t const count(values.size());
+		std::size_t i(0);
+
+#ifdef INDEX_IMAGES_HAVE_SSSE3_SWAP
+		if (has_ssse3())
+			i = swap_bytes_ssse3 <sizeof(t_value)>(data, count);
+#endif
+		
+		// Tail.
+		swap_bytes_scalar(data + i, count - i);
+	}
+}
+
+
+namespace index_images {
+	
+	void swap_bytes(gsl::span <std::uint16_t> values) { swap_bytes_(values); }
+	void swap_bytes(gsl::span <std::uint32_t> values) { swap_bytes_(values); }
+	void swap_bytes(gsl::span <std::uint64_t> values) { swap_bytes_(values); }
+}
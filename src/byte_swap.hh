@@ -0,0 +1,22 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_BYTE_SWAP_HH
+#define INDEX_IMAGES_BYTE_SWAP_HH
+
+#include <cstdint>
+#include <gsl/span>
+
+
+namespace index_images {
+	
+	// Reverse the byte order of each value in place. On x86, SSSE3 byte shuffles are used
+	// if the processor supports them, and the remainder is handled one value at a time.
+	void swap_bytes(gsl::span <std::uint16_t> values);
+	void swap_bytes(gsl::span <std::uint32_t> values);
+	void swap_bytes(gsl::span <std::uint64_t> values);
+}
+
+#endif
@@ -5,19 +5,24 @@
 
 #include <algorithm>
 #include <boost/gil.hpp>
-#include <boost/gil/extension/io/jpeg.hpp>
-#include <boost/gil/extension/io/tiff.hpp>
 #include <boost/gil/extension/numeric/sampler.hpp>
 #include <boost/gil/extension/numeric/resample.hpp>
-#include <boost/iostreams/device/back_inserter.hpp>
-#include <boost/iostreams/stream.hpp>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
 #include <libbio/assert.hh>
 #include <libbio/file_handling.hh>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "concrete_raw_processor.hh"
 #include "dop_parser.hh"
-#include "libraw_exif_reader.hh"
+#include "exif_tag_registry.hh"
+#include "tiff_walker.hh"
+
+#ifdef _OPENMP
+#	include <omp.h>
+#endif
 
-namespace bios = boost::iostreams;
 namespace gil = boost::gil;
 namespace lb = libbio;
 
@@ -35,92 +40,31 @@ namespace {
 	}
 	
 	
+	// Store the registered tags. The tags that LibRaw also handles are processed too for the
+	// metadata-only mode; otherwise they are overwritten with LibRaw’s values.
 	void exif_callback(void *context, int tag, int type, int len, unsigned int ord, void *ifp, INT64 base)
 	{
 		auto &ds(*reinterpret_cast <LibRaw_abstract_datastream *>(ifp));
 		auto &processor(*reinterpret_cast <ii::concrete_raw_processor *>(context));
-		auto &exif_properties(processor.get_exif_properties());
-		
-		switch (tag)
-		{
-			case 0x8298: 	// Copyright
-			case 0x108298:
-			{
-				if (ii::libraw_exif::read_single_ascii(ds, type, len, ord, exif_properties.copyright))
-					trim(exif_properties.copyright);
-				else
-					std::cerr << "Unexpected value for copyright.\n";
-				break;
-			}
-			
-			case 0x8822: // Exposure program
-			{
-				if (!ii::libraw_exif::read_single_short(ds, type, len, ord, exif_properties.exposure_program))
-					std::cerr << "Unexpected value for exposure program.\n";
-				break;
-			}
-			
-			//case 0x9201: // Shutter
-			case 0x829a: // Exposure
-			{
-				if (!ii::libraw_exif::read_single_rational(ds, type, len, ord, exif_properties.exposure_time))
-					std::cerr << "Unexpected value for shutter speed.\n";
-				break;
-			}
-			
-			case 0x9209: // Flash
-			{
-				if (!ii::libraw_exif::read_single_short(ds, type, len, ord, exif_properties.flash))
-					std::cerr << "Unexpected value for flash.\n";
-				break;
-			}
-			
-			case 0xa434: // Lens model
-			{
-				std::string dst;
-				if (!ii::libraw_exif::read_single_ascii(ds, type, len, ord, exif_properties.lens_model))
-					std::cerr << "Unexpected value for lens model.\n";
-				break;
-			}
-			
-			default:
-				break;
-		}
+		ii::exif_tags::read_tag(ds, tag, type, len, ord, processor.get_exif_buffer(), processor.get_exif_properties());
 	}
 	
 	
-	// Custom deleter from libraw memory images.
-	struct free_dcraw_mem_image
+	// Resize the source view to the destination buffer.
+	template <typename t_dst_pixel, typename t_src_view>
+	void resize_image(t_src_view const &src_view, std::uint16_t const width, std::uint16_t const height, std::vector <std::uint8_t> &dst_buffer)
 	{
-		void operator()(libraw_processed_image_t *ptr)
-		{
-			LibRaw::dcraw_clear_mem(ptr);
-		}
-	};
-	
-	
-	// Write the source image to the given view and save it as JPEG.
-	template <typename t_src, typename t_dst>
-	void resize_image(t_src const &src_view, t_dst &dst_image, ii::raw_processor::buffer_type &buffer)
-	{
-		auto dst_view(gil::view(dst_image));
+		dst_buffer.resize(width * height * sizeof(t_dst_pixel));
+		auto const dst_view(gil::interleaved_view(width, height, reinterpret_cast <t_dst_pixel *>(dst_buffer.data()), width * sizeof(t_dst_pixel)));
 		gil::resize_view(src_view, dst_view, gil::bilinear_sampler());
-
-		// Write the JPEG data to the given vector.
-		typedef bios::back_insert_device <ii::raw_processor::buffer_type> sink_type;
-		buffer.clear();
-		sink_type sink(buffer);
-		bios::stream <sink_type> os(sink);
-		gil::write_view(os, dst_view, gil::image_write_info <gil::jpeg_tag>(85));
 	}
 	
 	
-	void assign_first_string(std::string const &src, std::string &dst)
+	// Copy the given fixed-size string up to the first NUL character.
+	template <std::size_t t_size>
+	void assign_first_string(char const (&src)[t_size], std::string &dst)
 	{
-		if (auto const pos(src.find_first_of('\0')); pos == std::string::npos)
-			dst = src;
-		else
-			dst = src.substr(0, pos);
+		dst.assign(src, strnlen(src, t_size));
 	}
 }
 
@@ -148,12 +92,55 @@ namespace index_images {
 	}
 	
 	
+	// Compute the exposure statistics from the unpacked Bayer data.
+	void concrete_raw_processor::read_exposure_statistics()
+	{
+		auto const &sizes(m_processor.imgdata.sizes);
+		auto const &color(m_processor.imgdata.color);
+		auto const *raw_image(m_processor.imgdata.rawdata.raw_image);
+		
+		// Other CFA patterns (e.g. X-Trans) and non-Bayer images are not handled.
+		if (!raw_image || m_processor.imgdata.idata.filters < 1000)
+			return;
+		
+		raw_image_description desc;
+		desc.data = raw_image;
+		desc.pitch = sizes.raw_pitch / sizeof(std::uint16_t);
+		desc.top_margin = sizes.top_margin;
+		desc.left_margin = sizes.left_margin;
+		desc.width = sizes.width;
+		desc.height = sizes.height;
+		desc.white_level = std::min(color.maximum, unsigned(UINT16_MAX));
+		for (std::size_t row(0); row < 2; ++row)
+		{
+			for (std::size_t col(0); col < 2; ++col)
+			{
+				// The second green is reported as channel 3.
+				auto const channel(m_processor.COLOR(row, col));
+				auto black(color.black + color.cblack[channel]);
+				if (color.cblack[4] && color.cblack[5])
+					black += color.cblack[6 + (row % color.cblack[4]) * color.cblack[5] + col % color.cblack[5]];
+				
+				desc.cfa_channels[2 * row + col] = (3 == channel ? 1 : channel);
+				desc.black_levels[2 * row + col] = std::min(black, unsigned(UINT16_MAX));
+			}
+		}
+		
+		m_exposure_statistics = compute_exposure_statistics(desc);
+	}
+	
+	
 	// Read the relevant sidecar data.
 	void concrete_raw_processor::read_dop_data(std::string const &path)
 	{
 		m_dop_properties = dop_properties();
 		
-		auto const dop_path(path + ".dop");
+		// Avoid the lookup if the directory listing did not contain the sidecar.
+		if (!(m_sidecars & (SIDECAR_DOP | SIDECAR_UNKNOWN)))
+			return;
+		
+		// The AST built by the parser is not pooled, so images with sidecars still cause allocations.
+		auto const &dop_path(m_dop_path.assign(path).append(".dop"));
 		lb::file_istream stream;
 		if (lb::try_open_file_for_reading(dop_path, stream))
 		{
@@ -199,7 +186,7 @@ namespace index_images {
 						// Continue.
 					}
 				}
-				
+			
 			}
 			catch (boost::bad_get const &)
 			{
@@ -209,123 +196,248 @@ namespace index_images {
 	}
 	
 	
+	// Read the whole file to the reusable buffer.
+	bool concrete_raw_processor::read_file(std::string const &path)
+	{
+		auto const fd(open(path.c_str(), O_RDONLY));
+		if (-1 == fd)
+			return false;
+		
+		struct stat sb{};
+		if (-1 == fstat(fd, &sb))
+		{
+			close(fd);
+			return false;
+		}
+		
+		m_file_buffer.resize(sb.st_size);
+		std::size_t pos(0);
+		while (pos < m_file_buffer.size())
+		{
+			auto const res(read(fd, m_file_buffer.data() + pos, m_file_buffer.size() - pos));
+			if (res <= 0)
+			{
+				if (-1 == res && EINTR == errno)
+					continue;
+				
+				close(fd);
+				return false;
+			}
+			pos += res;
+		}
+		
+		close(fd);
+		return true;
+	}
+	
+	
+	// Record the failure. The message is output by the caller.
+	void concrete_raw_processor::fail(processing_stage const stage, int const error_code, char const *message)
+	{
+		m_failure.stage = stage;
+		m_failure.error_code = error_code;
+		m_failure.message = message;
+	}
+	
+	
 	// Prepare m_processor.
-	void concrete_raw_processor::prepare_file(std::string const &path)
+	bool concrete_raw_processor::prepare_file(std::string const &path)
 	{
+		m_exif_properties.clear();
+		m_exposure_statistics = exposure_statistics();
+		m_failure.clear();
 		read_dop_data(path);
 		
 		m_processor.set_exifparser_handler(&exif_callback, this);
 		
-		m_processor.open_file(path.c_str()); // Checked from the source that the file is opened read-only.
-		m_processor.unpack();
+		// Use a datastream stored in this object instead of letting LibRaw allocate one.
+		if (!read_file(path))
+		{
+			fail(processing_stage::READ, errno, std::strerror(errno));
+			m_file_buffer.clear();
+			return false;
+		}
+		m_datastream.emplace(m_file_buffer.data(), m_file_buffer.size());
 		
-		read_additional_exif_data();
+		auto st(m_processor.open_datastream(&*m_datastream));
+		if (LIBRAW_SUCCESS != st)
+			fail(processing_stage::OPEN, st, libraw_strerror(st));
+		else if (LIBRAW_SUCCESS != (st = m_processor.unpack()))
+			fail(processing_stage::UNPACK, st, libraw_strerror(st));
+		else
+		{
+			read_exposure_statistics();
+			read_additional_exif_data();
+		}
 		
 		m_processor.recycle_datastream();
+		
+		if (m_failure.has_failed())
+		{
+			m_processor.recycle();
+			return false;
+		}
+		
+		return true;
+	}
+	
+	
+	// Read the EXIF and DOP data without LibRaw by mapping the file and walking its IFDs.
+	void concrete_raw_processor::read_metadata(std::string const &path)
+	{
+		m_exif_properties.clear();
+		m_buffer.clear();
+		m_thumbnail.clear();
+		m_hashes = perceptual_hashes();
+		m_exposure_statistics = exposure_statistics();
+		m_failure.clear();
+		read_dop_data(path);
+		
+		if (!m_mapped_file.open(path))
+		{
+			fail(processing_stage::READ, errno, std::strerror(errno));
+			return;
+		}
+		
+		m_datastream.emplace(m_mapped_file.data(), m_mapped_file.size());
+		if (!walk_tiff(*m_datastream, &exif_callback, this))
+			fail(processing_stage::METADATA, 0, "Unable to parse the TIFF header");
+		
+		m_datastream.reset();
+		m_mapped_file.close();
 	}
 	
 	
 	// Helper function for determining the scaled image size.
-	auto concrete_raw_processor::scaled_image_size(std::size_t const width, std::size_t const height) -> std::pair <std::uint16_t, std::uint16_t>
+	auto concrete_raw_processor::scaled_image_size(std::size_t const width, std::size_t const height, double const max_size) -> std::pair <std::uint16_t, std::uint16_t>
 	{
 		auto const max_dim(std::max(width, height));
-		double const max_size(1024.0);
 		auto const factor(max_size / max_dim);
 		return std::pair <std::uint16_t, std::uint16_t>(factor * width, factor * height);
 	}
 	
 	
-	// Process the prepared image.
-	// Use a parallel queue at the call site.
-	void concrete_raw_processor::process_image()
+	// Copy the processed image to m_processed_buffer, resize and encode as JPEG.
+	bool concrete_raw_processor::make_preview()
 	{
-		typedef bios::stream <bios::array_sink> buffer_ostream;
-	
-		// Convert the RAW to RGB.
+		int width(0), height(0), colors(0), bps(0);
+		m_processor.get_mem_image_format(&width, &height, &colors, &bps);
+		libbio_always_assert_msg(8 == bps || 16 == bps, "Unexpected number of bits.");
+		
+		std::size_t const stride(width * colors * (bps / 8));
+		m_processed_buffer.resize(stride * height);
+		if (auto const st(m_processor.copy_mem_image(m_processed_buffer.data(), stride, 0)); LIBRAW_SUCCESS != st)
 		{
-			auto const st(m_processor.dcraw_process());
-			if (LIBRAW_SUCCESS != st)
-			{
-				std::cerr << "*** Got a libraw error: " << libraw_strerror(st) << '\n';
-				goto end;
-			}
+			fail(processing_stage::PREVIEW, st, libraw_strerror(st));
+			return false;
 		}
 		
+		auto const scaled_size(scaled_image_size(width, height, 1024.0));
+		auto const *data(m_processed_buffer.data());
+		
+		// Get an image view and resize.
+		switch (colors)
 		{
-			// Get the RGB output.
-			int status(0);
-			std::unique_ptr <libraw_processed_image_t, free_dcraw_mem_image> processed_image(m_processor.dcraw_make_mem_image(&status));
-			if (!processed_image)
+			case 1:
 			{
-				std::cerr << "*** Got a libraw error: " << libraw_strerror(status) << '\n';
-				goto end;
+				if (8 == bps)
+				{
+					auto const src_view(gil::interleaved_view(width, height, reinterpret_cast <gil::gray8_pixel_t const *>(data), stride));
+					resize_image <gil::gray8_pixel_t>(src_view, scaled_size.first, scaled_size.second, m_scaled_buffer);
+				}
+				else
+				{
+					auto const src_view(gil::interleaved_view(width, height, reinterpret_cast <gil::gray16_pixel_t const *>(data), stride));
+					resize_image <gil::gray8_pixel_t>(src_view, scaled_size.first, scaled_size.second, m_scaled_buffer);
+				}
+				break;
 			}
-
-			libbio_always_assert_msg(LIBRAW_IMAGE_BITMAP == processed_image->type, "Expected to get a bitmap.");
-			auto const scaled_size(scaled_image_size(processed_image->width, processed_image->height));
 			
-			// Get an image view and resize.
-			switch (processed_image->colors)
+			case 3:
 			{
-				case 1:
+				if (8 == bps)
 				{
-					gil::gray8_image_t dst_image(scaled_size.first, scaled_size.second);
-					switch (processed_image->bits)
-					{
-						case 8:
-						{
-							auto const *pixel_ptr(reinterpret_cast <gil::gray8_pixel_t const *>(processed_image->data));
-							auto const src_view(gil::interleaved_view(processed_image->width, processed_image->height, pixel_ptr, processed_image->width * sizeof(char)));
-							resize_image(src_view, dst_image, m_buffer);
-							break;
-						}
-						case 16:
-						{
-							// May not work if LibRaw does not allocate with the correct alignment.
-							auto const *pixel_ptr(reinterpret_cast <gil::gray16_pixel_t const *>(processed_image->data));
-							auto const src_view(gil::interleaved_view(processed_image->width, processed_image->height, pixel_ptr, processed_image->width * 2 * sizeof(char)));
-							resize_image(src_view, dst_image, m_buffer);
-							break;
-						}
-						default:
-							libbio_fail("Unexpected number of bits.");
-					}
-					break;
+					auto const src_view(gil::interleaved_view(width, height, reinterpret_cast <gil::rgb8_pixel_t const *>(data), stride));
+					resize_image <gil::rgb8_pixel_t>(src_view, scaled_size.first, scaled_size.second, m_scaled_buffer);
 				}
-					
-				case 3:
+				else
 				{
-					gil::rgb8_image_t dst_image(scaled_size.first, scaled_size.second);
-					switch (processed_image->bits)
-					{
-						case 8:
-						{
-							auto const *pixel_ptr(reinterpret_cast <gil::rgb8_pixel_t const *>(processed_image->data));
-							auto const src_view(gil::interleaved_view(processed_image->width, processed_image->height, pixel_ptr, 3 * processed_image->width * sizeof(char)));
-							resize_image(src_view, dst_image, m_buffer);
-							break;
-						}
-						case 16:
-						{
-							// May not work if LibRaw does not allocate with the correct alignment.
-							auto const *pixel_ptr(reinterpret_cast <gil::rgb16_pixel_t const *>(processed_image->data));
-							auto const src_view(gil::interleaved_view(processed_image->width, processed_image->height, pixel_ptr, 3 * processed_image->width * 2 * sizeof(char)));
-							resize_image(src_view, dst_image, m_buffer);
-							break;
-						}
-						default:
-							libbio_fail("Unexpected number of bits.");
-					}
-					break;
+					auto const src_view(gil::interleaved_view(width, height, reinterpret_cast <gil::rgb16_pixel_t const *>(data), stride));
+					resize_image <gil::rgb8_pixel_t>(src_view, scaled_size.first, scaled_size.second, m_scaled_buffer);
 				}
-					
-				default:
-					libbio_fail("Unexpected number of colour components.");
+				break;
+			}
+			
+			default:
+				libbio_fail("Unexpected number of colour components.");
+		}
+		
+		// Hash the downscaled image before encoding it.
+		m_hashes = compute_perceptual_hashes(m_scaled_buffer.data(), scaled_size.first, scaled_size.second, colors);
+		if (!m_jpeg_encoder.encode(m_scaled_buffer.data(), scaled_size.first, scaled_size.second, colors, 85, m_buffer))
+		{
+			fail(processing_stage::PREVIEW, 0, "Unable to encode the preview");
+			return false;
+		}
+		
+		if (!make_thumbnail(scaled_size.first, scaled_size.second, colors))
+		{
+			fail(processing_stage::PREVIEW, 0, "Unable to encode the thumbnail");
+			return false;
+		}
+		
+		return true;
+	}
+	
+	
+	// Resize the preview image in m_scaled_buffer further and encode as JPEG.
+	bool concrete_raw_processor::make_thumbnail(std::uint16_t const width, std::uint16_t const height, int const colors)
+	{
+		auto const scaled_size(scaled_image_size(width, height, 256.0));
+		switch (colors)
+		{
+			case 1:
+			{
+				auto const src_view(gil::interleaved_view(width, height, reinterpret_cast <gil::gray8_pixel_t const *>(m_scaled_buffer.data()), width));
+				resize_image <gil::gray8_pixel_t>(src_view, scaled_size.first, scaled_size.second, m_thumbnail_scaled_buffer);
+				break;
+			}
+			
+			case 3:
+			{
+				auto const src_view(gil::interleaved_view(width, height, reinterpret_cast <gil::rgb8_pixel_t const *>(m_scaled_buffer.data()), 3 * width));
+				resize_image <gil::rgb8_pixel_t>(src_view, scaled_size.first, scaled_size.second, m_thumbnail_scaled_buffer);
+				break;
 			}
+			
+			default:
+				libbio_fail("Unexpected number of colour components.");
 		}
+		
+		return m_jpeg_encoder.encode(m_thumbnail_scaled_buffer.data(), scaled_size.first, scaled_size.second, colors, 80, m_thumbnail);
+	}
+	
+	
+	// Process the prepared image.
+	// Use a parallel queue at the call site.
+	void concrete_raw_processor::process_image()
+	{
+		m_buffer.clear();
+		m_thumbnail.clear();
+		m_hashes = perceptual_hashes();
 
-	end:
-		// Free memory.
+#ifdef _OPENMP
+		// Applies to the parallel regions started by the calling thread.
+		omp_set_num_threads(m_thread_count);
+#endif
+		
+		// Convert the RAW to RGB.
+		if (auto const st(m_processor.dcraw_process()); LIBRAW_SUCCESS != st)
+			fail(processing_stage::PROCESS, st, libraw_strerror(st));
+		else
+			make_preview();
+		
+		// Free LibRaw’s memory.
 		m_processor.recycle();
 	}
 }
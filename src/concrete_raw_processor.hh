@@ -6,6 +6,9 @@
 #ifndef INDEX_IMAGES_CONCRETE_RAW_PROCESSOR_HH
 #define INDEX_IMAGES_CONCRETE_RAW_PROCESSOR_HH
 
+#include <optional>
+#include "jpeg_encoder.hh"
+#include "mapped_file.hh"
 #include "raw_processor.hh"
 
 // Does not use namespaces.
@@ -14,21 +17,40 @@
 
 namespace index_images {
 	
+	// Keeps its buffers between images, so that after processing a few images only LibRaw’s
+	// internal buffers are allocated per image.
 	class concrete_raw_processor : public raw_processor
 	{
 	protected:
-		LibRaw		m_processor;
+		LibRaw										m_processor;
+		std::optional <LibRaw_buffer_datastream>	m_datastream;
+		std::vector <std::uint8_t>					m_file_buffer;		// Contents of the RAW file.
+		std::vector <std::uint8_t>					m_processed_buffer;	// Output of dcraw_process().
+		std::vector <std::uint8_t>					m_scaled_buffer;	// Resized image, 8 bits per component.
+		std::vector <std::uint8_t>					m_thumbnail_scaled_buffer;
+		std::string									m_dop_path;
+		std::vector <std::byte>						m_exif_buffer;		// For reading EXIF values.
+		mapped_file									m_mapped_file;		// For reading metadata only.
+		jpeg_encoder								m_jpeg_encoder;
 		
 	public:
 		using raw_processor::raw_processor;
 		
-		void prepare_file(std::string const &path) override;
+		bool prepare_file(std::string const &path) override;
 		void process_image() override;
+		void read_metadata(std::string const &path) override;
+		
+		std::vector <std::byte> &get_exif_buffer() { return m_exif_buffer; }
 		
 	protected:
+		void fail(processing_stage const stage, int const error_code, char const *message);
+		bool read_file(std::string const &path);
+		bool make_preview();
+		bool make_thumbnail(std::uint16_t const width, std::uint16_t const height, int const colors);
 		void read_additional_exif_data();
+		void read_exposure_statistics();
 		void read_dop_data(std::string const &path);
-		std::pair <std::uint16_t, std::uint16_t> scaled_image_size(std::size_t const width, std::size_t const height);
+		std::pair <std::uint16_t, std::uint16_t> scaled_image_size(std::size_t const width, std::size_t const height, double const max_size);
 	};
 }
 
@@ -0,0 +1,548 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <memory>
+#include <poll.h>
+#include <spawn.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <type_traits>
+#include <unistd.h>
+#include "decode_worker.hh"
+
+extern char **environ;
+
+
+namespace {
+	
+	namespace ii = index_images;
+	
+	
+	// Large enough for the metadata, the preview and the thumbnail. Only the touched pages are allocated.
+	constexpr std::size_t SHARED_MEMORY_SIZE{64 * 1024 * 1024};
+	
+	
+	enum request_kind : std::uint8_t
+	{
+		PREPARE_FILE = 1,
+		PROCESS_IMAGE,
+		READ_METADATA
+	};
+	
+	
+	// Precedes the path in the shared memory.
+	struct request_header
+	{
+		std::uint64_t	path_length{};
+		std::uint16_t	thread_count{};
+		std::uint8_t	sidecars{};
+		std::uint8_t	kind{};
+	};
+	
+	
+	// Serialise values to the shared memory. Both processes run the same executable,
+	// so trivially copyable values are copied as such.
+	class shared_memory_writer
+	{
+	protected:
+		std::byte		*m_data{};
+		std::size_t		m_size{};
+		std::size_t		m_position{};
+		bool			m_has_overflowed{};
+		
+	public:
+		shared_memory_writer(std::byte *data, std::size_t const size):
+			m_data(data),
+			m_size(size)
+		{
+		}
+		
+		bool has_overflowed() const { return m_has_overflowed; }
+		
+		template <typename t_value>
+		void operator()(t_value const &value)
+		{
+			static_assert(std::is_trivially_copyable_v <t_value>);
+			write_bytes(&value, sizeof(t_value));
+		}
+		
+		void operator()(std::string const &value) { write_sequence(value); }
+		void operator()(ii::raw_processor::buffer_type const &value) { write_sequence(value); }
+		
+	protected:
+		template <typename t_sequence>
+		void write_sequence(t_sequence const &value)
+		{
+			std::uint64_t const size(value.size());
+			(*this)(size);
+			write_bytes(value.data(), size);
+		}
+		
+		void write_bytes(void const *src, std::size_t const size);
+	};
+	
+	
+	class shared_memory_reader
+	{
+	protected:
+		std::byte const	*m_data{};
+		std::size_t		m_size{};
+		std::size_t		m_position{};
+		
+	public:
+		shared_memory_reader(std::byte const *data, std::size_t const size):
+			m_data(data),
+			m_size(size)
+		{
+		}
+		
+		template <typename t_value>
+		void operator()(t_value &value)
+		{
+			static_assert(std::is_trivially_copyable_v <t_value>);
+			read_bytes(&value, sizeof(t_value));
+		}
+		
+		void operator()(std::string &value) { read_sequence(value); }
+		void operator()(ii::raw_processor::buffer_type &value) { read_sequence(value); }
+		
+	protected:
+		template <typename t_sequence>
+		void read_sequence(t_sequence &value)
+		{
+			std::uint64_t size(0);
+			(*this)(size);
+			size = std::min(size, std::uint64_t(m_size - m_position));
+			value.resize(size);
+			read_bytes(value.data(), size);
+		}
+		
+		void read_bytes(void *dst, std::size_t const size);
+	};
+	
+	
+	void shared_memory_writer::write_bytes(void const *src, std::size_t const size)
+	{
+		if (m_size - m_position < size)
+		{
+			m_has_overflowed = true;
+			return;
+		}
+		
+		std::memcpy(m_data + m_position, src, size);
+		m_position += size;
+	}
+	
+	
+	void shared_memory_reader::read_bytes(void *dst, std::size_t const size)
+	{
+		// The writer checks the sizes, so this should not happen.
+		if (m_size - m_position < size)
+			return;
+		
+		std::memcpy(dst, m_data + m_position, size);
+		m_position += size;
+	}
+	
+	
+	// Pass the result members to the archive in a fixed order. Used for both writing and reading,
+	// so the types are either const or non-const.
+	template <
+		typename t_archive,
+		typename t_exif_properties,
+		typename t_dop_properties,
+		typename t_hashes,
+		typename t_exposure_statistics,
+		typename t_failure,
+		typename t_buffer
+	>
+	void transfer_result(
+		t_archive &ar,
+		t_exif_properties &exif,
+		t_dop_properties &dop,
+		t_hashes &hashes,
+		t_exposure_statistics &exposure_stats,
+		t_failure &failure,
+		t_buffer &preview,
+		t_buffer &thumbnail
+	)
+	{
+		ar(failure.stage);
+		ar(failure.error_code);
+		ar(failure.message);
+		
+		ar(exif.artist);
+		ar(exif.copyright);
+		ar(exif.make);
+		ar(exif.model);
+		ar(exif.lens_model);
+		ar(exif.body_serial);
+		ar(exif.lens_serial);
+		ar(exif.gps);
+		ar(exif.exposure_time.first);	// std::pair is not trivially copyable.
+		ar(exif.exposure_time.second);
+		ar(exif.timestamp);
+		ar(exif.wall_clock_time);
+		ar(exif.shutter_count);
+		ar(exif.subsec_time);
+		ar(exif.utc_offset);
+		ar(exif.aperture);
+		ar(exif.focal_length);
+		ar(exif.iso_speed);
+		ar(exif.exposure_program);
+		ar(exif.flash);
+		ar(exif.orientation);
+		ar(exif.has_utc_offset);
+		
+		ar(dop);
+		ar(hashes);
+		ar(exposure_stats);
+		ar(preview);
+		ar(thumbnail);
+	}
+	
+	
+	// Move the descriptor out of the range used for passing the descriptors to the worker.
+	int move_descriptor(int const fd)
+	{
+		if (ii::DECODE_WORKER_SOCKET_FD < fd)
+		{
+			fcntl(fd, F_SETFD, FD_CLOEXEC);
+			return fd;
+		}
+		
+		auto const retval(fcntl(fd, F_DUPFD_CLOEXEC, ii::DECODE_WORKER_SOCKET_FD + 1));
+		close(fd);
+		return retval;
+	}
+	
+	
+	// Create an unnamed shared memory object.
+	int create_shared_memory()
+	{
+		static std::atomic <std::uint32_t> counter{};
+		auto const name(std::string("/index_images.") + std::to_string(getpid()) + '.' + std::to_string(counter++));
+		auto const fd(shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600));
+		if (-1 == fd)
+			return -1;
+		
+		shm_unlink(name.c_str());
+		if (-1 == ftruncate(fd, SHARED_MEMORY_SIZE))
+		{
+			close(fd);
+			return -1;
+		}
+		
+		return move_descriptor(fd);
+	}
+	
+	
+	bool read_byte(int const fd, char &byte)
+	{
+		while (true)
+		{
+			auto const res(read(fd, &byte, 1));
+			if (1 == res)
+				return true;
+			if (-1 == res && EINTR == errno)
+				continue;
+			return false;
+		}
+	}
+	
+	
+	bool write_byte(int const fd, char const byte)
+	{
+		while (true)
+		{
+			auto const res(write(fd, &byte, 1));
+			if (1 == res)
+				return true;
+			if (-1 == res && EINTR == errno)
+				continue;
+			return false;
+		}
+	}
+}
+
+
+namespace index_images {
+	
+	int run_decode_worker(std::uint64_t const memory_limit)
+	{
+		if (memory_limit)
+		{
+			struct rlimit const limit{memory_limit, memory_limit};
+			setrlimit(RLIMIT_AS, &limit);
+		}
+		
+		auto *data(mmap(nullptr, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, DECODE_WORKER_SHARED_MEMORY_FD, 0));
+		if (MAP_FAILED == data)
+			return EXIT_FAILURE;
+		
+		auto *shared_memory(static_cast <std::byte *>(data));
+		std::unique_ptr <raw_processor> proc(raw_processor::instantiate());
+		std::string path;
+		char byte{};
+		
+		// Stop when the parent closes the socket.
+		while (read_byte(DECODE_WORKER_SOCKET_FD, byte))
+		{
+			request_header header;
+			std::memcpy(&header, shared_memory, sizeof(request_header));
+			path.assign(reinterpret_cast <char const *>(shared_memory + sizeof(request_header)), header.path_length);
+			
+			proc->set_thread_count(header.thread_count);
+			proc->set_sidecars(header.sidecars);
+			switch (header.kind)
+			{
+				case PREPARE_FILE:
+					proc->prepare_file(path);
+					break;
+				
+				case PROCESS_IMAGE:
+					proc->process_image();
+					break;
+				
+				case READ_METADATA:
+					proc->read_metadata(path);
+					break;
+				
+				default:
+					return EXIT_FAILURE;
+			}
+			
+			shared_memory_writer writer(shared_memory, SHARED_MEMORY_SIZE);
+			transfer_result(
+				writer,
+				proc->get_exif_properties(),
+				proc->get_dop_properties(),
+				proc->get_hashes(),
+				proc->get_exposure_statistics(),
+				proc->get_failure(),
+				proc->get_buffer(),
+				proc->get_thumbnail()
+			);
+			
+			if (!write_byte(DECODE_WORKER_SOCKET_FD, writer.has_overflowed() ? 1 : 0))
+				return EXIT_FAILURE;
+		}
+		
+		return EXIT_SUCCESS;
+	}
+	
+	
+	isolated_raw_processor::~isolated_raw_processor()
+	{
+		// The worker exits after the socket has been closed.
+		int status(0);
+		stop_worker(false, status);
+		
+		if (m_shared_memory)
+			munmap(m_shared_memory, SHARED_MEMORY_SIZE);
+		if (-1 != m_shared_memory_fd)
+			close(m_shared_memory_fd);
+	}
+	
+	
+	bool isolated_raw_processor::prepare_file(std::string const &path)
+	{
+		m_deadline = clock_type::now() + std::chrono::seconds(m_limits->timeout);
+		run_request(PREPARE_FILE, path);
+		return !m_failure.has_failed();
+	}
+	
+	
+	void isolated_raw_processor::process_image()
+	{
+		run_request(PROCESS_IMAGE, std::string());
+	}
+	
+	
+	void isolated_raw_processor::read_metadata(std::string const &path)
+	{
+		m_deadline = clock_type::now() + std::chrono::seconds(m_limits->timeout);
+		run_request(READ_METADATA, path);
+	}
+	
+	
+	void isolated_raw_processor::clear_result()
+	{
+		m_buffer.clear();
+		m_thumbnail.clear();
+		m_exif_properties.clear();
+		m_dop_properties = dop_properties();
+		m_hashes = perceptual_hashes();
+		m_exposure_statistics = exposure_statistics();
+		m_failure.clear();
+	}
+	
+	
+	void isolated_raw_processor::fail(processing_stage const stage, int const error_code, std::string const &message)
+	{
+		clear_result();
+		m_failure.stage = stage;
+		m_failure.error_code = error_code;
+		m_failure.message = message;
+	}
+	
+	
+	// Pass the request to the worker and wait for the result until the deadline.
+	void isolated_raw_processor::run_request(std::uint8_t const kind, std::string const &path)
+	{
+		if (SHARED_MEMORY_SIZE - sizeof(request_header) < path.size())
+		{
+			fail(processing_stage::READ, ENAMETOOLONG, std::strerror(ENAMETOOLONG));
+			return;
+		}
+		
+		if (-1 == m_pid && !start_worker())
+		{
+			fail(processing_stage::CRASH, errno, std::string("Unable to start a worker process: ") + std::strerror(errno));
+			return;
+		}
+		
+		request_header header;
+		header.path_length = path.size();
+		header.thread_count = m_thread_count;
+		header.sidecars = m_sidecars;
+		header.kind = kind;
+		std::memcpy(m_shared_memory, &header, sizeof(request_header));
+		std::memcpy(m_shared_memory + sizeof(request_header), path.data(), path.size());
+		
+		char status{};
+		bool did_respond(false);
+		bool did_time_out(false);
+		if (write_byte(m_socket_fd, kind))
+		{
+			pollfd pfd{m_socket_fd, POLLIN, 0};
+			while (true)
+			{
+				auto const remaining(std::chrono::duration_cast <std::chrono::milliseconds>(m_deadline - clock_type::now()).count());
+				if (remaining <= 0)
+				{
+					did_time_out = true;
+					break;
+				}
+				
+				auto const res(poll(&pfd, 1, std::min(remaining, decltype(remaining)(INT32_MAX))));
+				if (-1 == res && EINTR == errno)
+					continue;
+				
+				// Zero means that the time limit was exceeded; the loop is continued to check the deadline.
+				if (0 != res)
+				{
+					did_respond = (1 == res && read_byte(m_socket_fd, status));
+					break;
+				}
+			}
+		}
+		
+		if (did_time_out)
+		{
+			int exit_status(0);
+			stop_worker(true, exit_status);
+			fail(processing_stage::TIMEOUT, 0, "Exceeded the time limit of " + std::to_string(m_limits->timeout) + " seconds");
+			return;
+		}
+		
+		if (!did_respond)
+		{
+			int exit_status(0);
+			stop_worker(false, exit_status);
+			if (WIFSIGNALED(exit_status))
+				fail(processing_stage::CRASH, WTERMSIG(exit_status), std::string("The worker process was terminated: ") + strsignal(WTERMSIG(exit_status)));
+			else
+				fail(processing_stage::CRASH, WEXITSTATUS(exit_status), "The worker process exited with status " + std::to_string(WEXITSTATUS(exit_status)));
+			return;
+		}
+		
+		if (status)
+		{
+			fail(processing_stage::PREVIEW, 0, "The result did not fit in the shared memory");
+			return;
+		}
+		
+		shared_memory_reader reader(m_shared_memory, SHARED_MEMORY_SIZE);
+		transfer_result(reader, m_exif_properties, m_dop_properties, m_hashes, m_exposure_statistics, m_failure, m_buffer, m_thumbnail);
+	}
+	
+	
+	bool isolated_raw_processor::start_worker()
+	{
+		if (!m_shared_memory)
+		{
+			m_shared_memory_fd = create_shared_memory();
+			if (-1 == m_shared_memory_fd)
+				return false;
+			
+			auto *data(mmap(nullptr, SHARED_MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, m_shared_memory_fd, 0));
+			if (MAP_FAILED == data)
+				return false;
+			m_shared_memory = static_cast <std::byte *>(data);
+		}
+		
+		int fds[2]{-1, -1};
+		if (-1 == socketpair(AF_UNIX, SOCK_STREAM, 0, fds))
+			return false;
+		fds[0] = move_descriptor(fds[0]);
+		fds[1] = move_descriptor(fds[1]);
+		
+		// The descriptors have FD_CLOEXEC set, but dup2() clears it from the copies.
+		posix_spawn_file_actions_t actions;
+		posix_spawn_file_actions_init(&actions);
+		posix_spawn_file_actions_adddup2(&actions, m_shared_memory_fd, DECODE_WORKER_SHARED_MEMORY_FD);
+		posix_spawn_file_actions_adddup2(&actions, fds[1], DECODE_WORKER_SOCKET_FD);
+		
+		auto const memory_limit(std::to_string(m_limits->memory_limit));
+		char *argv[]{
+			const_cast <char *>(m_limits->executable_path.c_str()),
+			const_cast <char *>(DECODE_WORKER_ARGUMENT),
+			const_cast <char *>(memory_limit.c_str()),
+			nullptr
+		};
+		
+		auto const res(posix_spawnp(&m_pid, m_limits->executable_path.c_str(), &actions, nullptr, argv, environ));
+		posix_spawn_file_actions_destroy(&actions);
+		close(fds[1]);
+		
+		if (0 != res)
+		{
+			close(fds[0]);
+			m_pid = -1;
+			errno = res;
+			return false;
+		}
+		
+		m_socket_fd = fds[0];
+		return true;
+	}
+	
+	
+	void isolated_raw_processor::stop_worker(bool const should_kill, int &status)
+	{
+		if (-1 == m_pid)
+			return;
+		
+		if (should_kill)
+			kill(m_pid, SIGKILL);
+		
+		close(m_socket_fd);
+		m_socket_fd = -1;
+		
+		while (-1 == waitpid(m_pid, &status, 0) && EINTR == errno)
+			;
+		m_pid = -1;
+	}
+}
@@ -0,0 +1,80 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_DECODE_WORKER_HH
+#define INDEX_IMAGES_DECODE_WORKER_HH
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+#include "raw_processor.hh"
+
+
+namespace index_images {
+	
+	// Decoding in separate processes. Each isolated_raw_processor starts a copy of the executable
+	// with DECODE_WORKER_ARGUMENT, passes it the paths and receives the results through a shared
+	// memory region. A socket pair is used for signalling. If the worker crashes or does not
+	// respond within the time limit, it is killed and replaced on the next request.
+	
+	char const * const DECODE_WORKER_ARGUMENT{"--decode-worker"};
+	
+	// The file descriptors are passed to the worker with these numbers.
+	enum { DECODE_WORKER_SHARED_MEMORY_FD = 3, DECODE_WORKER_SOCKET_FD = 4 };
+	
+	
+	struct decode_worker_limits
+	{
+		std::string		executable_path;	// For starting the workers; looked up from PATH if there is no slash.
+		std::uint64_t	memory_limit{};		// Address space of each worker in bytes, zero for no limit.
+		std::uint32_t	timeout{};			// Seconds per image.
+	};
+	
+	
+	// Entry point of the worker process.
+	int run_decode_worker(std::uint64_t const memory_limit);
+	
+	
+	// Forwards the calls to a worker process.
+	class isolated_raw_processor final : public raw_processor
+	{
+	protected:
+		typedef std::chrono::steady_clock	clock_type;
+		
+	protected:
+		decode_worker_limits const	*m_limits{};
+		std::byte					*m_shared_memory{};
+		clock_type::time_point		m_deadline{};		// For the current image.
+		pid_t						m_pid{-1};
+		int							m_shared_memory_fd{-1};
+		int							m_socket_fd{-1};
+		
+	public:
+		explicit isolated_raw_processor(decode_worker_limits const &limits):
+			m_limits(&limits)
+		{
+		}
+		
+		~isolated_raw_processor();
+		
+		isolated_raw_processor(isolated_raw_processor const &) = delete;
+		isolated_raw_processor &operator=(isolated_raw_processor const &) = delete;
+		
+		bool prepare_file(std::string const &path) override;
+		void process_image() override;
+		void read_metadata(std::string const &path) override;
+		
+	protected:
+		void run_request(std::uint8_t const kind, std::string const &path);
+		void clear_result();
+		void fail(processing_stage const stage, int const error_code, std::string const &message);
+		bool start_worker();
+		void stop_worker(bool const should_kill, int &status);
+	};
+}
+
+#endif
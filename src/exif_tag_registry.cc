@@ -0,0 +1,367 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string_view>
+#include "exif_tag_registry.hh"
+#include "libraw_exif_reader.hh"
+
+
+namespace {
+	
+	namespace ii = index_images;
+	namespace et = index_images::exif_tags;
+	namespace le = index_images::libraw_exif;
+	
+	
+	// Flags added to the tag number by LibRaw’s callback.
+	constexpr std::uint32_t const ifd0{0x100000};
+	constexpr std::uint32_t const gps_ifd{0x50000};
+	
+	// Payloads of registered tags are small; guard against damaged files.
+	constexpr std::size_t const max_payload_size{4096};
+	
+	
+	// Copy the values from the payload and convert them to the native byte order in one go.
+	template <typename t_value>
+	bool decode(et::entry_value const &val, t_value *dst, std::size_t const count)
+	{
+		static_assert(std::is_same_v <t_value, std::uint16_t> || std::is_same_v <t_value, std::uint32_t>);
+		std::memcpy(dst, val.data, count * sizeof(t_value));
+		return le::to_native_order(val.order, gsl::span <t_value>(dst, count));
+	}
+	
+	
+	std::string_view ascii_value(et::entry_value const &val)
+	{
+		std::string_view retval(reinterpret_cast <char const *>(val.data), val.count);
+		if (auto const pos(retval.find('\0')); std::string_view::npos != pos)
+			retval.remove_suffix(retval.size() - pos);
+		if (auto const pos(retval.find_last_not_of(" \n\r\t")); std::string_view::npos != pos)
+			retval.remove_suffix(retval.size() - pos - 1);
+		else
+			retval = std::string_view();
+		return retval;
+	}
+	
+	
+	// Handlers, instantiated for each destination.
+	template <std::string ii::exif_properties::*t_member>
+	bool assign_ascii(ii::exif_properties &props, et::entry_value const &val)
+	{
+		auto const str(ascii_value(val));
+		(props.*t_member).assign(str.data(), str.size());
+		return true;
+	}
+	
+	
+	template <std::uint16_t ii::exif_properties::*t_member>
+	bool assign_short(ii::exif_properties &props, et::entry_value const &val)
+	{
+		return decode(val, &(props.*t_member), 1);
+	}
+	
+	
+	template <std::uint32_t ii::exif_properties::*t_member>
+	bool assign_long(ii::exif_properties &props, et::entry_value const &val)
+	{
+		return decode(val, &(props.*t_member), 1);
+	}
+	
+	
+	template <float ii::exif_properties::*t_member>
+	bool assign_short_as_float(ii::exif_properties &props, et::entry_value const &val)
+	{
+		std::uint16_t value(0);
+		if (!decode(val, &value, 1))
+			return false;
+		props.*t_member = value;
+		return true;
+	}
+	
+	
+	template <ii::rational_type ii::exif_properties::*t_member>
+	bool assign_rational(ii::exif_properties &props, et::entry_value const &val)
+	{
+		std::array <std::uint32_t, 2> values{};
+		if (!decode(val, values.data(), 2))
+			return false;
+		props.*t_member = ii::rational_type(values[0], values[1]);
+		return true;
+	}
+	
+	
+	template <float ii::exif_properties::*t_member>
+	bool assign_rational_as_float(ii::exif_properties &props, et::entry_value const &val)
+	{
+		std::array <std::uint32_t, 2> values{};
+		if (! (decode(val, values.data(), 2) && values[1]))
+			return false;
+		props.*t_member = float(values[0]) / values[1];
+		return true;
+	}
+	
+	
+	// Parse an EXIF date as local time like LibRaw does.
+	bool assign_timestamp(ii::exif_properties &props, et::entry_value const &val)
+	{
+		auto const str(ascii_value(val));
+		std::array <char, 32> buffer{};
+		if (buffer.size() <= str.size())
+			return false;
+		std::copy(str.begin(), str.end(), buffer.begin());
+		
+		std::tm tm{};
+		if (6 != std::sscanf(buffer.data(), "%d:%d:%d %d:%d:%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec))
+			return false;
+		
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		tm.tm_isdst = -1;
+		if (tm.tm_mon < 0)
+			return false;
+		
+		// mktime() normalises tm, so make a copy for timegm().
+		auto tm_utc(tm);
+		auto const timestamp(std::mktime(&tm));
+		if (-1 == timestamp)
+			return false;
+		
+		props.timestamp = timestamp;
+		props.wall_clock_time = timegm(&tm_utc);
+		return true;
+	}
+	
+	
+	// Fractional seconds as decimal digits, e.g. "25" for 0.25 s.
+	bool assign_subsec_time(ii::exif_properties &props, et::entry_value const &val)
+	{
+		auto const str(ascii_value(val));
+		std::uint32_t value(0);
+		std::size_t digits(0);
+		for (auto const c : str)
+		{
+			if (c < '0' || '9' < c)
+				return false;
+			
+			// Only microseconds are stored.
+			if (6 == digits)
+				break;
+			
+			value = 10 * value + (c - '0');
+			++digits;
+		}
+		
+		if (!digits)
+			return false;
+		
+		for (; digits < 6; ++digits)
+			value *= 10;
+		
+		props.subsec_time = value;
+		return true;
+	}
+	
+	
+	// UTC offset as “±HH:MM”.
+	bool assign_utc_offset(ii::exif_properties &props, et::entry_value const &val)
+	{
+		auto const str(ascii_value(val));
+		std::array <char, 16> buffer{};
+		if (buffer.size() <= str.size())
+			return false;
+		std::copy(str.begin(), str.end(), buffer.begin());
+		
+		char sign{};
+		int hours(0), minutes(0);
+		if (3 != std::sscanf(buffer.data(), "%c%d:%d", &sign, &hours, &minutes))
+			return false;
+		if (! ('+' == sign || '-' == sign) || hours < 0 || 14 < hours || minutes < 0 || 59 < minutes)
+			return false;
+		
+		props.utc_offset = ('-' == sign ? -1 : 1) * (3600 * hours + 60 * minutes);
+		props.has_utc_offset = true;
+		return true;
+	}
+	
+	
+	// Degrees, minutes and seconds.
+	template <double ii::gps_position::*t_member>
+	bool assign_gps_coordinate(ii::exif_properties &props, et::entry_value const &val)
+	{
+		std::array <std::uint32_t, 6> values{};
+		if (!decode(val, values.data(), 6))
+			return false;
+		
+		double retval(0);
+		double divisor(1);
+		for (std::size_t i(0); i < 3; ++i)
+		{
+			if (!values[2 * i + 1])
+				return false;
+			retval += double(values[2 * i]) / values[2 * i + 1] / divisor;
+			divisor *= 60;
+		}
+		
+		props.gps.*t_member = retval;
+		props.gps.has_coordinates = true;
+		return true;
+	}
+	
+	
+	template <bool ii::gps_position::*t_member, char t_negative>
+	bool assign_gps_reference(ii::exif_properties &props, et::entry_value const &val)
+	{
+		auto const str(ascii_value(val));
+		props.gps.*t_member = (!str.empty() && t_negative == str.front());
+		return true;
+	}
+	
+	
+	bool assign_gps_altitude_reference(ii::exif_properties &props, et::entry_value const &val)
+	{
+		props.gps.is_below_sea_level = (std::byte(1) == val.data[0]);
+		return true;
+	}
+	
+	
+	bool assign_gps_altitude(ii::exif_properties &props, et::entry_value const &val)
+	{
+		std::array <std::uint32_t, 2> values{};
+		if (! (decode(val, values.data(), 2) && values[1]))
+			return false;
+		props.gps.altitude = double(values[0]) / values[1];
+		props.gps.has_altitude = true;
+		return true;
+	}
+	
+	
+	template <std::size_t t_size>
+	constexpr std::array <et::tag_info, t_size> sorted(std::array <et::tag_info, t_size> array)
+	{
+		// Insertion sort, since std::sort is not constexpr.
+		for (std::size_t i(1); i < t_size; ++i)
+		{
+			for (std::size_t j(i); 0 < j && array[j].tag < array[j - 1].tag; --j)
+			{
+				auto const tmp(array[j]);
+				array[j] = array[j - 1];
+				array[j - 1] = tmp;
+			}
+		}
+		return array;
+	}
+	
+	
+	template <std::size_t t_size>
+	constexpr bool has_unique_tags(std::array <et::tag_info, t_size> const &array)
+	{
+		for (std::size_t i(1); i < t_size; ++i)
+		{
+			if (array[i - 1].tag == array[i].tag)
+				return false;
+		}
+		return true;
+	}
+	
+	
+	typedef ii::exif_properties ep;
+	typedef ii::gps_position gp;
+	
+	// The registry. To store a new tag, add a member to exif_properties and a row here.
+	constexpr auto const registry(sorted(std::array{
+		et::tag_info{ifd0 | 0x010f,		le::ASCII,		0,	"make",				&assign_ascii <&ep::make>},
+		et::tag_info{ifd0 | 0x0110,		le::ASCII,		0,	"model",			&assign_ascii <&ep::model>},
+		et::tag_info{ifd0 | 0x0112,		le::SHORT,		1,	"orientation",		&assign_short <&ep::orientation>},
+		et::tag_info{ifd0 | 0x0132,		le::ASCII,		0,	"date and time",	&assign_timestamp},
+		et::tag_info{ifd0 | 0x013b,		le::ASCII,		0,	"artist",			&assign_ascii <&ep::artist>},
+		et::tag_info{ifd0 | 0x8298,		le::ASCII,		0,	"copyright",		&assign_ascii <&ep::copyright>},
+		et::tag_info{0x8298,			le::ASCII,		0,	"copyright",		&assign_ascii <&ep::copyright>},
+		et::tag_info{0x829a,			le::RATIONAL,	1,	"exposure time",	&assign_rational <&ep::exposure_time>},
+		et::tag_info{0x829d,			le::RATIONAL,	1,	"aperture",			&assign_rational_as_float <&ep::aperture>},
+		et::tag_info{0x8822,			le::SHORT,		1,	"exposure program",	&assign_short <&ep::exposure_program>},
+		et::tag_info{0x8827,			le::SHORT,		1,	"ISO speed",		&assign_short_as_float <&ep::iso_speed>},
+		et::tag_info{0x9003,			le::ASCII,		0,	"date and time",	&assign_timestamp},	// Overrides the one in IFD0.
+		et::tag_info{0x9011,			le::ASCII,		0,	"UTC offset",		&assign_utc_offset},	// Of the original date and time.
+		et::tag_info{0x9291,			le::ASCII,		0,	"subsec. time",		&assign_subsec_time},	// Of the original date and time.
+		et::tag_info{0x9209,			le::SHORT,		1,	"flash",			&assign_short <&ep::flash>},
+		et::tag_info{0x920a,			le::RATIONAL,	1,	"focal length",		&assign_rational_as_float <&ep::focal_length>},
+		et::tag_info{0x9211,			le::LONG,		1,	"shutter count",	&assign_long <&ep::shutter_count>},		// Image number.
+		et::tag_info{0xa431,			le::ASCII,		0,	"body serial",		&assign_ascii <&ep::body_serial>},
+		et::tag_info{0xa434,			le::ASCII,		0,	"lens model",		&assign_ascii <&ep::lens_model>},
+		et::tag_info{0xa435,			le::ASCII,		0,	"lens serial",		&assign_ascii <&ep::lens_serial>},
+		et::tag_info{gps_ifd | 0x0001,	le::ASCII,		2,	"latitude ref.",	&assign_gps_reference <&gp::is_south, 'S'>},
+		et::tag_info{gps_ifd | 0x0002,	le::RATIONAL,	3,	"latitude",			&assign_gps_coordinate <&gp::latitude>},
+		et::tag_info{gps_ifd | 0x0003,	le::ASCII,		2,	"longitude ref.",	&assign_gps_reference <&gp::is_west, 'W'>},
+		et::tag_info{gps_ifd | 0x0004,	le::RATIONAL,	3,	"longitude",		&assign_gps_coordinate <&gp::longitude>},
+		et::tag_info{gps_ifd | 0x0005,	le::BYTE,		1,	"altitude ref.",	&assign_gps_altitude_reference},
+		et::tag_info{gps_ifd | 0x0006,	le::RATIONAL,	1,	"altitude",			&assign_gps_altitude}
+	}));
+	
+	static_assert(has_unique_tags(registry));
+}
+
+
+namespace index_images { namespace exif_tags {
+	
+	tag_info const *find(std::uint32_t const tag)
+	{
+		auto const it(std::lower_bound(registry.begin(), registry.end(), tag, [](auto const &info, auto const tag){
+			return info.tag < tag;
+		}));
+		
+		if (registry.end() == it || it->tag != tag)
+			return nullptr;
+		return &*it;
+	}
+	
+	
+	bool read_tag(
+		LibRaw_abstract_datastream &ds,
+		std::uint32_t const tag,
+		int const type,
+		std::size_t const count,
+		std::uint16_t const order,
+		std::vector <std::byte> &buffer,
+		exif_properties &dst
+	)
+	{
+		auto const *info(find(tag));
+		if (!info)
+			return false;
+		
+		if (type != info->type || (info->count && count != info->count))
+		{
+			std::cerr << "Unexpected value for " << info->name << ".\n";
+			return false;
+		}
+		
+		// One read for the whole payload.
+		auto const size(le::tiff_type_size(type) * count);
+		if (0 == size || max_payload_size < size)
+			return false;
+		
+		buffer.resize(size);
+		if (1 != ds.read(buffer.data(), size, 1))
+		{
+			std::cerr << "Unable to read the value for " << info->name << ".\n";
+			return false;
+		}
+		
+		entry_value const val{buffer.data(), count, order};
+		if (!(*info->handler)(dst, val))
+		{
+			std::cerr << "Unexpected value for " << info->name << ".\n";
+			return false;
+		}
+		
+		return true;
+	}
+}}
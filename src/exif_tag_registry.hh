@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_EXIF_TAG_REGISTRY_HH
+#define INDEX_IMAGES_EXIF_TAG_REGISTRY_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "raw_processor.hh"
+
+// Does not use namespaces.
+#include <libraw/libraw.h>
+
+
+// Table of the EXIF tags that are stored. Tags are given as reported by LibRaw’s EXIF callback
+// (see tiff_walker.hh), so the IFD is encoded in the upper bits.
+namespace index_images { namespace exif_tags {
+	
+	// One IFD entry’s payload, as read from the file.
+	struct entry_value
+	{
+		std::byte const	*data{};
+		std::size_t		count{};
+		std::uint16_t	order{};
+	};
+	
+	typedef bool (*handler_type)(exif_properties &, entry_value const &);
+	
+	struct tag_info
+	{
+		std::uint32_t	tag{};
+		int				type{};			// Expected TIFF type.
+		std::uint32_t	count{};		// Expected number of values, or zero for any.
+		char const		*name{};
+		handler_type	handler{};
+	};
+	
+	// Returns nullptr if the tag is not handled.
+	tag_info const *find(std::uint32_t const tag);
+	
+	// Read the payload of a registered tag with one read from the stream, and store the value.
+	// The buffer is used for the payload. Returns false and leaves the properties unchanged
+	// if the tag is not registered.
+	bool read_tag(
+		LibRaw_abstract_datastream &ds,
+		std::uint32_t const tag,
+		int const type,
+		std::size_t const count,
+		std::uint16_t const order,
+		std::vector <std::byte> &buffer,
+		exif_properties &dst
+	);
+}}
+
+#endif
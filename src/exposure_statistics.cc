@@ -0,0 +1,132 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include "exposure_statistics.hh"
+
+
+namespace {
+	
+	namespace ii = index_images;
+	
+	enum { SAMPLED_ROW_PAIRS = 128 };
+	
+	
+	struct channel_sums
+	{
+		std::array <std::uint64_t, ii::EXPOSURE_CHANNEL_COUNT>	sums{};
+		std::array <std::uint64_t, ii::EXPOSURE_CHANNEL_COUNT>	counts{};
+		std::uint64_t											clipped{};
+		std::uint64_t											dark{};
+	};
+	
+	
+	// Process one row. The photosites alternate between two channels, so the sums are
+	// accumulated separately for the even and the odd columns. Both the sums and the histograms
+	// are relative to each photosite’s own black level.
+	void process_row(
+		ii::raw_image_description const &desc,
+		std::uint16_t const *row,
+		std::size_t const cfa_row,
+		std::uint32_t const range,
+		ii::exposure_statistics::histogram_type &histograms,
+		channel_sums &acc
+	)
+	{
+		auto const even_channel(desc.cfa_channels[2 * cfa_row]);
+		auto const odd_channel(desc.cfa_channels[2 * cfa_row + 1]);
+		std::uint32_t const even_black(desc.black_levels[2 * cfa_row]);
+		std::uint32_t const odd_black(desc.black_levels[2 * cfa_row + 1]);
+		std::uint32_t const even_dark(even_black + range / 256);
+		std::uint32_t const odd_dark(odd_black + range / 256);
+		std::uint32_t const clip_threshold(desc.white_level - desc.white_level / 64);
+		auto const pair_count(desc.width / 2);
+		
+		std::uint64_t even_sum(0);
+		std::uint64_t odd_sum(0);
+		std::uint64_t clipped(0);
+		std::uint64_t dark(0);
+
+#pragma omp simd reduction(+: even_sum, odd_sum, clipped, dark)
+		for (std::size_t i = 0; i < pair_count; ++i)
+		{
+			std::uint32_t const even(row[2 * i]);
+			std::uint32_t const odd(row[2 * i + 1]);
+			even_sum += (even <= even_black ? 0 : even - even_black);
+			odd_sum += (odd <= odd_black ? 0 : odd - odd_black);
+			clipped += (clip_threshold <= even) + (clip_threshold <= odd);
+			dark += (even <= even_dark) + (odd <= odd_dark);
+		}
+		
+		acc.sums[even_channel] += even_sum;
+		acc.sums[odd_channel] += odd_sum;
+		acc.counts[even_channel] += pair_count;
+		acc.counts[odd_channel] += pair_count;
+		acc.clipped += clipped;
+		acc.dark += dark;
+		
+		// The histogram updates are scattered, so they are done separately while the row is still in the cache.
+		auto *even_histogram(histograms.data() + even_channel * ii::EXPOSURE_HISTOGRAM_BINS);
+		auto *odd_histogram(histograms.data() + odd_channel * ii::EXPOSURE_HISTOGRAM_BINS);
+		for (std::size_t i(0); i < pair_count; ++i)
+		{
+			std::uint32_t const even(row[2 * i]);
+			std::uint32_t const odd(row[2 * i + 1]);
+			auto const even_bin(std::uint64_t(even <= even_black ? 0 : even - even_black) * ii::EXPOSURE_HISTOGRAM_BINS / range);
+			auto const odd_bin(std::uint64_t(odd <= odd_black ? 0 : odd - odd_black) * ii::EXPOSURE_HISTOGRAM_BINS / range);
+			++even_histogram[std::min <std::uint64_t>(even_bin, ii::EXPOSURE_HISTOGRAM_BINS - 1)];
+			++odd_histogram[std::min <std::uint64_t>(odd_bin, ii::EXPOSURE_HISTOGRAM_BINS - 1)];
+		}
+	}
+}
+
+
+namespace index_images {
+	
+	exposure_statistics compute_exposure_statistics(raw_image_description const &desc)
+	{
+		exposure_statistics retval;
+		
+		auto const max_black(*std::max_element(desc.black_levels.begin(), desc.black_levels.end()));
+		if (!desc.data || desc.width < 2 || desc.height < 2 || desc.white_level <= max_black)
+			return retval;
+		
+		std::uint32_t const range(desc.white_level - max_black);
+		
+		// Sample row pairs at even intervals, so that the CFA pattern is the same in each pair.
+		auto const row_step(std::max <std::size_t>(2, (desc.height / SAMPLED_ROW_PAIRS) & ~std::size_t(1)));
+		channel_sums acc;
+		for (std::size_t y(0); y + 1 < desc.height; y += row_step)
+		{
+			for (std::size_t i(0); i < 2; ++i)
+			{
+				auto const *row(desc.data + (desc.top_margin + y + i) * desc.pitch + desc.left_margin);
+				process_row(desc, row, i, range, retval.histograms, acc);
+			}
+		}
+		
+		std::uint64_t total(0);
+		std::array <float, EXPOSURE_CHANNEL_COUNT> means{};
+		for (std::size_t i(0); i < EXPOSURE_CHANNEL_COUNT; ++i)
+		{
+			total += acc.counts[i];
+			if (acc.counts[i])
+			{
+				float const mean(double(acc.sums[i]) / acc.counts[i]);
+				means[i] = std::clamp(mean / range, 0.0f, 1.0f);
+			}
+		}
+		
+		if (!total)
+			return retval;
+		
+		// Rec. 709 weights applied to the camera’s channels; good enough for finding badly exposed images.
+		retval.mean_luminance = 0.2126f * means[0] + 0.7152f * means[1] + 0.0722f * means[2];
+		retval.clipped_fraction = float(acc.clipped) / total;
+		retval.dark_fraction = float(acc.dark) / total;
+		retval.is_valid = true;
+		return retval;
+	}
+}
@@ -0,0 +1,51 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_EXPOSURE_STATISTICS_HH
+#define INDEX_IMAGES_EXPOSURE_STATISTICS_HH
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace index_images {
+	
+	enum { EXPOSURE_CHANNEL_COUNT = 3, EXPOSURE_HISTOGRAM_BINS = 64 };
+	
+	
+	// Unpacked Bayer data as provided by LibRaw.
+	struct raw_image_description
+	{
+		std::uint16_t const				*data{};
+		std::size_t						pitch{};			// In values.
+		std::size_t						top_margin{};
+		std::size_t						left_margin{};
+		std::size_t						width{};			// Visible area.
+		std::size_t						height{};
+		std::array <std::uint8_t, 4>	cfa_channels{};		// Channels (0–2) of the 2×2 block at the visible area’s origin, row by row.
+		std::array <std::uint16_t, 4>	black_levels{};		// Corresponding black levels.
+		std::uint16_t					white_level{};
+	};
+	
+	
+	// Computed from the photosites of a sparse set of rows. The values are linear and relative to
+	// the range between the black and white levels.
+	struct exposure_statistics
+	{
+		typedef std::array <std::uint32_t, EXPOSURE_CHANNEL_COUNT * EXPOSURE_HISTOGRAM_BINS> histogram_type;
+		
+		histogram_type	histograms{};			// Red, green and blue, one after another.
+		float			clipped_fraction{};		// Photosites at or near the white level.
+		float			dark_fraction{};		// Photosites within 1/256 of the range from the black level.
+		float			mean_luminance{};
+		bool			is_valid{};
+	};
+	
+	
+	exposure_statistics compute_exposure_statistics(raw_image_description const &desc);
+}
+
+#endif
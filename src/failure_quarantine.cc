@@ -0,0 +1,65 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <chrono>
+#include "failure_quarantine.hh"
+
+
+namespace index_images {
+	
+	void failure_quarantine::load(sqlite::database &db)
+	{
+		m_signatures.clear();
+		db << u8"SELECT filename, file_size, file_mtime, stage FROM failure;"
+			>> [this](std::string const &filename, std::int64_t const size, std::int64_t const mtime, std::string const &stage){
+				// An unrecognised stage is treated as a decoding failure, since that is the conservative choice.
+				m_signatures[filename] = file_signature{std::uintmax_t(size), mtime, needs_decoding(processing_stage_from_string(stage))};
+			};
+	}
+	
+	
+	bool failure_quarantine::contains(scheduled_image const &image) const
+	{
+		auto const it(m_signatures.find(image.path));
+		if (m_signatures.end() == it)
+			return false;
+		
+		auto const &signature(it->second);
+		return signature.size == image.size && signature.mtime == image.mtime;
+	}
+	
+	
+	void failure_quarantine::record(sqlite::database &db, scheduled_image const &image, processing_failure const &failure)
+	{
+		auto const now(std::chrono::duration_cast <std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+		db
+			<< u8"INSERT OR REPLACE INTO failure ("
+			"filename, stage, error_code, message, file_size, file_mtime, recorded_at"
+			") VALUES (?, ?, ?, ?, ?, ?, ?);"
+			<< image.path
+			<< to_string(failure.stage)
+			<< failure.error_code
+			<< failure.message
+			<< std::int64_t(image.size)
+			<< image.mtime
+			<< std::int64_t(now);
+		
+		m_signatures[image.path] = file_signature{image.size, image.mtime, needs_decoding(failure.stage)};
+	}
+	
+	
+	void failure_quarantine::remove(sqlite::database &db, std::string const &path, bool const was_decoded)
+	{
+		auto const it(m_signatures.find(path));
+		if (m_signatures.end() == it)
+			return;
+		
+		if (!was_decoded && it->second.needs_decoding)
+			return;
+		
+		db << u8"DELETE FROM failure WHERE filename = ?;" << path;
+		m_signatures.erase(it);
+	}
+}
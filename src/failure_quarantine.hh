@@ -0,0 +1,56 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_FAILURE_QUARANTINE_HH
+#define INDEX_IMAGES_FAILURE_QUARANTINE_HH
+
+#include <cstdint>
+#include <sqlite_modern_cpp.h>
+#include <string>
+#include <unordered_map>
+#include "raw_processor.hh"
+#include "work_stealing_queue.hh"
+
+
+namespace index_images {
+	
+	// In-memory copy of the failure table. A file is skipped while its size and modification
+	// time match those recorded when processing it failed.
+	class failure_quarantine
+	{
+	protected:
+		struct file_signature
+		{
+			std::uintmax_t	size{};
+			std::int64_t	mtime{};
+			bool			needs_decoding{};	// True if only decoding the image shows that the failure was resolved.
+		};
+		
+		typedef std::unordered_map <std::string, file_signature>	map_type;
+		
+	protected:
+		map_type	m_signatures;
+		
+	public:
+		failure_quarantine() = default;
+		
+		void load(sqlite::database &db);
+		
+		// Check whether the image failed previously and has not been modified since.
+		bool contains(scheduled_image const &image) const;
+		
+		// Add or replace the failure table row of the given image.
+		void record(sqlite::database &db, scheduled_image const &image, processing_failure const &failure);
+		
+		// Remove the row of the given image if there is one after it was processed successfully.
+		// If only the metadata was read, failures in the decoding stages are retained.
+		void remove(sqlite::database &db, std::string const &path, bool const was_decoded);
+		
+	protected:
+		static bool needs_decoding(processing_stage const stage) { return !(processing_stage::READ == stage || processing_stage::METADATA == stage); }
+	};
+}
+
+#endif
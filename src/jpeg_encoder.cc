@@ -0,0 +1,119 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <iostream>
+#include <libbio/assert.hh>
+#include "jpeg_encoder.hh"
+
+
+namespace index_images {
+	
+	jpeg_encoder::jpeg_encoder()
+	{
+		m_cinfo.err = jpeg_std_error(&m_error_mgr);
+		m_error_mgr.error_exit = &error_exit;
+		m_cinfo.client_data = this;
+		jpeg_create_compress(&m_cinfo);
+		
+		m_destination.init_destination = &init_destination;
+		m_destination.empty_output_buffer = &empty_output_buffer;
+		m_destination.term_destination = &term_destination;
+		m_cinfo.dest = &m_destination;
+	}
+	
+	
+	jpeg_encoder::~jpeg_encoder()
+	{
+		jpeg_destroy_compress(&m_cinfo);
+	}
+	
+	
+	bool jpeg_encoder::encode(
+		std::uint8_t const *pixels,
+		std::uint32_t const width,
+		std::uint32_t const height,
+		std::uint8_t const components,
+		int const quality,
+		buffer_type &dst
+	)
+	{
+		libbio_assert(1 == components || 3 == components);
+		
+		m_buffer = &dst;
+		
+		// libjpeg reports errors by calling error_exit, which jumps here.
+		if (setjmp(m_error_jmp_buf))
+		{
+			jpeg_abort_compress(&m_cinfo);
+			dst.clear();
+			m_buffer = nullptr;
+			return false;
+		}
+		
+		m_cinfo.image_width = width;
+		m_cinfo.image_height = height;
+		m_cinfo.input_components = components;
+		m_cinfo.in_color_space = (1 == components ? JCS_GRAYSCALE : JCS_RGB);
+		jpeg_set_defaults(&m_cinfo);
+		jpeg_set_quality(&m_cinfo, quality, TRUE);
+		
+		jpeg_start_compress(&m_cinfo, TRUE);
+		std::size_t const stride(width * components);
+		while (m_cinfo.next_scanline < m_cinfo.image_height)
+		{
+			// libjpeg does not modify the input but its interface is not const-correct.
+			auto *row(const_cast <JSAMPLE *>(pixels + m_cinfo.next_scanline * stride));
+			jpeg_write_scanlines(&m_cinfo, &row, 1);
+		}
+		jpeg_finish_compress(&m_cinfo);
+		
+		m_buffer = nullptr;
+		return true;
+	}
+	
+	
+	// Use the whole capacity of the output buffer.
+	void jpeg_encoder::init_destination(j_compress_ptr cinfo)
+	{
+		auto &self(*static_cast <jpeg_encoder *>(cinfo->client_data));
+		auto &buffer(*self.m_buffer);
+		buffer.resize(std::max(buffer.capacity(), std::size_t(65536)));
+		self.m_destination.next_output_byte = reinterpret_cast <JOCTET *>(buffer.data());
+		self.m_destination.free_in_buffer = buffer.size();
+	}
+	
+	
+	// Called when the buffer is full; double its size.
+	boolean jpeg_encoder::empty_output_buffer(j_compress_ptr cinfo)
+	{
+		auto &self(*static_cast <jpeg_encoder *>(cinfo->client_data));
+		auto &buffer(*self.m_buffer);
+		auto const used(buffer.size());
+		buffer.resize(2 * used);
+		self.m_destination.next_output_byte = reinterpret_cast <JOCTET *>(buffer.data() + used);
+		self.m_destination.free_in_buffer = buffer.size() - used;
+		return TRUE;
+	}
+	
+	
+	// Trim the unused part.
+	void jpeg_encoder::term_destination(j_compress_ptr cinfo)
+	{
+		auto &self(*static_cast <jpeg_encoder *>(cinfo->client_data));
+		auto &buffer(*self.m_buffer);
+		buffer.resize(buffer.size() - self.m_destination.free_in_buffer);
+	}
+	
+	
+	void jpeg_encoder::error_exit(j_common_ptr cinfo)
+	{
+		auto &self(*static_cast <jpeg_encoder *>(cinfo->client_data));
+		char message[JMSG_LENGTH_MAX]{};
+		(*cinfo->err->format_message)(cinfo, message);
+		std::cerr << "*** Got a libjpeg error: " << message << '\n';
+		std::longjmp(self.m_error_jmp_buf, 1);
+	}
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_JPEG_ENCODER_HH
+#define INDEX_IMAGES_JPEG_ENCODER_HH
+
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>	// Needed by jpeglib.h.
+#include <jpeglib.h>
+#include <vector>
+
+
+namespace index_images {
+	
+	// libjpeg compressor that is reused for every image and writes to a caller-supplied vector.
+	// The vector’s capacity is retained, so after the first few images encoding does not
+	// require growing the output buffer.
+	class jpeg_encoder
+	{
+	public:
+		typedef std::vector <char>	buffer_type;
+		
+	protected:
+		jpeg_compress_struct	m_cinfo{};
+		jpeg_error_mgr			m_error_mgr{};
+		jpeg_destination_mgr	m_destination{};
+		std::jmp_buf			m_error_jmp_buf{};
+		buffer_type				*m_buffer{};
+		
+	public:
+		jpeg_encoder();
+		~jpeg_encoder();
+		
+		jpeg_encoder(jpeg_encoder const &) = delete;
+		jpeg_encoder &operator=(jpeg_encoder const &) = delete;
+		
+		// Encode 8-bit interleaved pixels with one or three components.
+		bool encode(
+			std::uint8_t const *pixels,
+			std::uint32_t const width,
+			std::uint32_t const height,
+			std::uint8_t const components,
+			int const quality,
+			buffer_type &dst
+		);
+		
+	protected:
+		static void init_destination(j_compress_ptr cinfo);
+		static boolean empty_output_buffer(j_compress_ptr cinfo);
+		static void term_destination(j_compress_ptr cinfo);
+		[[noreturn]] static void error_exit(j_common_ptr cinfo);
+	};
+}
+
+#endif
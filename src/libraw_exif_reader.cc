@@ -8,14 +8,53 @@
 // Does not use namespaces.
 #include <libraw/libraw.h>
 
+#include "byte_swap.hh"
 #include "libraw_exif_reader.hh"
 
 
 namespace {
 	
+	namespace ii = index_images;
 	namespace le = index_images::libraw_exif;
 	
 	
+	template <std::size_t t_size> struct unsigned_type {};
+	template <> struct unsigned_type <2> { typedef std::uint16_t type; };
+	template <> struct unsigned_type <4> { typedef std::uint32_t type; };
+	template <> struct unsigned_type <8> { typedef std::uint64_t type; };
+	
+	
+	// Convert the values in place; floating point values are handled as unsigned integers of the same size.
+	template <typename t_value>
+	bool swap_to_native(std::uint16_t const ord, gsl::span <t_value> values)
+	{
+		namespace end = boost::endian;
+		
+		bool needs_swap(false);
+		switch (ord)
+		{
+			case 0x4949: // II
+				needs_swap = (end::order::little != end::order::native);
+				break;
+			
+			case 0x4d4d: // MM
+				needs_swap = (end::order::big != end::order::native);
+				break;
+			
+			default:
+				return false;
+		}
+		
+		if (needs_swap)
+		{
+			typedef typename unsigned_type <sizeof(t_value)>::type unsigned_value_type;
+			ii::swap_bytes(gsl::span <unsigned_value_type>(reinterpret_cast <unsigned_value_type *>(values.data()), values.size()));
+		}
+		
+		return true;
+	}
+	
+	
 	template <bool t_swap_bytes, typename t_dst>
 	inline bool copy_single_value(LibRaw_abstract_datastream &ds, t_dst &dst, std::uint16_t const ord)
 	{
@@ -27,63 +66,26 @@ namespace {
 		if constexpr (!t_swap_bytes)
 			return true;
 		else
-		{
-			switch (ord)
-			{
-				case 0x4949: // II
-					boost::endian::little_to_native_inplace(dst);
-					return true;
-			
-				case 0x4d4d: // MM
-					boost::endian::big_to_native_inplace(dst);
-					return true;
-			
-				default:
-					return false;
-			}
-		}
+			return swap_to_native(ord, gsl::span <t_dst>(&dst, 1));
 	}
 	
+	
 	template <bool t_swap_bytes, typename t_dst>
-	inline bool copy_multiple_values(LibRaw_abstract_datastream &ds, std::size_t const len, std::vector <t_dst> &dst, std::uint16_t const ord)
+	inline bool copy_multiple_values(LibRaw_abstract_datastream &ds, std::size_t const len, gsl::span <t_dst> dst, std::uint16_t const ord)
 	{
-		namespace end = boost::endian;
-		
+		// Read directly to the caller’s buffer.
+		if (dst.size() < len)
+			return false;
 		if (len != ds.read(dst.data(), sizeof(t_dst), len))
 			return false;
 		
 		if constexpr (!t_swap_bytes)
 			return true;
 		else
-		{
-			switch (ord)
-			{
-				case 0x4949: // II
-				{
-					if (end::order::little == end::order::native)
-						return true;
-				
-					for (auto &val : dst)
-						end::little_to_native_inplace(val);
-					return true;
-				}
-			
-				case 0x4d4d: // MM
-				{
-					if (end::order::big == end::order::native)
-						return true;
-				
-					for (auto &val : dst)
-						end::big_to_native_inplace(val);
-					return true;
-				}
-			
-				default:
-					return false;
-			}
-		}
+			return swap_to_native(ord, dst.subspan(0, len));
 	}
 	
+	
 	template <le::tiff_data_type t_data_type, bool t_swap_bytes, typename t_dst>
 	bool read_single_value(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, t_dst &dst)
 	{
@@ -108,24 +110,53 @@ namespace {
 	}
 	
 	template <le::tiff_data_type t_data_type, bool t_swap_bytes, typename t_dst>
-	bool read_multiple_values(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <t_dst> &dst)
+	bool read_multiple_values(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <t_dst> dst)
 	{
-		dst.clear();
-		
 		if (t_data_type != dt)
 			return false;
 		
-		dst.resize(len, t_dst());
-		
-		if (!copy_multiple_values <t_swap_bytes>(ds, len, dst, ord))
-			return false;
-		
-		return true;
+		return copy_multiple_values <t_swap_bytes>(ds, len, dst, ord);
 	}
 }
 
 namespace index_images { namespace libraw_exif {
 	
+	std::size_t tiff_type_size(int const dt)
+	{
+		switch (dt)
+		{
+			case BYTE:
+			case ASCII:
+			case SBYTE:
+			case UNDEFINED:
+				return 1;
+			
+			case SHORT:
+			case SSHORT:
+				return 2;
+			
+			case LONG:
+			case SLONG:
+			case FLOAT:
+			case 13: // IFD
+				return 4;
+			
+			case RATIONAL:
+			case SRATIONAL:
+			case DOUBLE:
+				return 8;
+			
+			default:
+				return 0;
+		}
+	}
+	
+	
+	bool to_native_order(std::uint16_t const ord, gsl::span <std::uint16_t> values)	{ return swap_to_native(ord, values); }
+	bool to_native_order(std::uint16_t const ord, gsl::span <std::uint32_t> values)	{ return swap_to_native(ord, values); }
+	bool to_native_order(std::uint16_t const ord, gsl::span <std::uint64_t> values)	{ return swap_to_native(ord, values); }
+	
+	
 	bool read_single_ascii(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::string &dst)
 	{
 		dst.clear();
@@ -151,18 +182,18 @@ namespace index_images { namespace libraw_exif {
 	bool read_single_undefined		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::byte &dst)									{ return read_single_value <tiff_data_type::UNDEFINED, false>			(ds, dt, len, ord, dst); }
 	bool read_single_sshort			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::int16_t &dst)								{ return read_single_value <tiff_data_type::SSHORT, true>				(ds, dt, len, ord, dst); }
 	bool read_single_slong			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::int32_t &dst)								{ return read_single_value <tiff_data_type::SLONG, true>				(ds, dt, len, ord, dst); }
-	bool read_single_float			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, float &dst)										{ return read_single_value <tiff_data_type::FLOAT, false>				(ds, dt, len, ord, dst); }
-	bool read_single_double			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, double &dst)										{ return read_single_value <tiff_data_type::DOUBLE, false>				(ds, dt, len, ord, dst); }
+	bool read_single_float			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, float &dst)										{ return read_single_value <tiff_data_type::FLOAT, true>				(ds, dt, len, ord, dst); }
+	bool read_single_double			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, double &dst)										{ return read_single_value <tiff_data_type::DOUBLE, true>				(ds, dt, len, ord, dst); }
 	bool read_single_rational		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::pair <std::uint32_t, std::uint32_t> &dst)	{ return read_single_rational_value <tiff_data_type::RATIONAL, true>	(ds, dt, len, ord, dst); }
 	bool read_single_srational		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::pair <std::int32_t, std::int32_t> &dst)		{ return read_single_rational_value <tiff_data_type::SRATIONAL, true>	(ds, dt, len, ord, dst); }
 	
-	bool read_multiple_byte			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::byte> &dst)					{ return read_multiple_values <tiff_data_type::BYTE, false>				(ds, dt, len, ord, dst); }
-	bool read_multiple_short		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::uint16_t> &dst)				{ return read_multiple_values <tiff_data_type::SHORT, true>				(ds, dt, len, ord, dst); }
-	bool read_multiple_long			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::uint32_t> &dst)				{ return read_multiple_values <tiff_data_type::LONG, true>				(ds, dt, len, ord, dst); }
-	bool read_multiple_sbyte		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <signed char> &dst)					{ return read_multiple_values <tiff_data_type::SBYTE, false>			(ds, dt, len, ord, dst); }
-	bool read_multiple_undefined	(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::byte> &dst)					{ return read_multiple_values <tiff_data_type::UNDEFINED, false>		(ds, dt, len, ord, dst); }
-	bool read_multiple_sshort		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::int16_t> &dst)					{ return read_multiple_values <tiff_data_type::SSHORT, true>			(ds, dt, len, ord, dst); }
-	bool read_multiple_slong		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::int32_t> &dst)					{ return read_multiple_values <tiff_data_type::SLONG, true>				(ds, dt, len, ord, dst); }
-	bool read_multiple_float		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <float> &dst)						{ return read_multiple_values <tiff_data_type::FLOAT, false>			(ds, dt, len, ord, dst); }
-	bool read_multiple_double		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <double> &dst)						{ return read_multiple_values <tiff_data_type::DOUBLE, false>			(ds, dt, len, ord, dst); }
+	bool read_multiple_byte			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::byte> dst)					{ return read_multiple_values <tiff_data_type::BYTE, false>				(ds, dt, len, ord, dst); }
+	bool read_multiple_short		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::uint16_t> dst)				{ return read_multiple_values <tiff_data_type::SHORT, true>				(ds, dt, len, ord, dst); }
+	bool read_multiple_long			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::uint32_t> dst)				{ return read_multiple_values <tiff_data_type::LONG, true>				(ds, dt, len, ord, dst); }
+	bool read_multiple_sbyte		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <signed char> dst)					{ return read_multiple_values <tiff_data_type::SBYTE, false>			(ds, dt, len, ord, dst); }
+	bool read_multiple_undefined	(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::byte> dst)					{ return read_multiple_values <tiff_data_type::UNDEFINED, false>		(ds, dt, len, ord, dst); }
+	bool read_multiple_sshort		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::int16_t> dst)					{ return read_multiple_values <tiff_data_type::SSHORT, true>			(ds, dt, len, ord, dst); }
+	bool read_multiple_slong		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::int32_t> dst)					{ return read_multiple_values <tiff_data_type::SLONG, true>				(ds, dt, len, ord, dst); }
+	bool read_multiple_float		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <float> dst)						{ return read_multiple_values <tiff_data_type::FLOAT, true>			(ds, dt, len, ord, dst); }
+	bool read_multiple_double		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <double> dst)						{ return read_multiple_values <tiff_data_type::DOUBLE, true>			(ds, dt, len, ord, dst); }
 }}
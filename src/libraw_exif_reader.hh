@@ -6,7 +6,11 @@
 #ifndef INDEX_IMAGES_LIBRAW_EXIF_READER_HH
 #define INDEX_IMAGES_LIBRAW_EXIF_READER_HH
 
+#include <cstddef>
+#include <cstdint>
+#include <gsl/span>
 #include <libbio/utility.hh>
+#include <string>
 
 
 // Handle EXIF data as part of Libraw’s callback.
@@ -32,12 +36,20 @@ namespace index_images { namespace libraw_exif {
 	{
 		return libbio::to_underlying(lhs) == rhs;
 	}
-
+	
 	inline bool operator!=(tiff_data_type const lhs, std::underlying_type_t <tiff_data_type> const rhs)
 	{
 		return !(lhs == rhs);
 	}
 	
+	// Size of one value of the given type in bytes, or zero if the type is not known.
+	std::size_t tiff_type_size(int const dt);
+	
+	// Convert the given values from the file’s byte order to the native one in place.
+	bool to_native_order(std::uint16_t const ord, gsl::span <std::uint16_t> values);
+	bool to_native_order(std::uint16_t const ord, gsl::span <std::uint32_t> values);
+	bool to_native_order(std::uint16_t const ord, gsl::span <std::uint64_t> values);
+	
 	bool read_single_ascii			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::string &dst);
 	bool read_single_byte			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::byte &dst);
 	bool read_single_short			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::uint16_t &dst);
@@ -51,15 +63,16 @@ namespace index_images { namespace libraw_exif {
 	bool read_single_rational		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::pair <std::uint32_t, std::uint32_t> &dst);
 	bool read_single_srational		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::pair <std::int32_t, std::int32_t> &dst);
 	
-	bool read_multiple_byte			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::byte> &dst);
-	bool read_multiple_short		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::uint16_t> &dst);
-	bool read_multiple_long			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::uint32_t> &dst);
-	bool read_multiple_sbyte		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <signed char> &dst);
-	bool read_multiple_undefined	(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::byte> &dst);
-	bool read_multiple_sshort		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::int16_t> &dst);
-	bool read_multiple_slong		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <std::int32_t> &dst);
-	bool read_multiple_float		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <float> &dst);
-	bool read_multiple_double		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, std::vector <double> &dst);
+	// Read len values to the beginning of dst, which needs to have room for them.
+	bool read_multiple_byte			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::byte> dst);
+	bool read_multiple_short		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::uint16_t> dst);
+	bool read_multiple_long			(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::uint32_t> dst);
+	bool read_multiple_sbyte		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <signed char> dst);
+	bool read_multiple_undefined	(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::byte> dst);
+	bool read_multiple_sshort		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::int16_t> dst);
+	bool read_multiple_slong		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <std::int32_t> dst);
+	bool read_multiple_float		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <float> dst);
+	bool read_multiple_double		(LibRaw_abstract_datastream &ds, int const dt, std::size_t const len, std::uint16_t const ord, gsl::span <double> dst);
 }}
 
 #endif
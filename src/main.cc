@@ -3,16 +3,47 @@
  * This code is licensed under MIT license (see LICENSE for details).
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <boost/endian/conversion.hpp>
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/range/iterator_range.hpp>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
+#include <iostream>
 #include <libbio/assert.hh>
 #include <libbio/dispatch.hh>
-#include <list>
+#include <mutex>
 #include <regex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
 #include <sqlite_modern_cpp.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "allocation_counter.hh"
 #include "cmdline.h"
+#include "decode_worker.hh"
+#include "failure_quarantine.hh"
+#include "merge.hh"
+#include "metadata_export.hh"
+#include "preview_server.hh"
+#include "processing_order.hh"
+#include "query.hh"
 #include "raw_processor.hh"
+#include "schema.hh"
+#include "sequences.hh"
+#include "shard.hh"
+#include "sidecars.hh"
+#include "string_dictionary.hh"
+#include "work_claims.hh"
+#include "work_stealing_queue.hh"
 
 namespace fs	= std::filesystem;
 namespace lb	= libbio;
@@ -22,32 +53,145 @@ namespace bios	= boost::iostreams;
 
 namespace {
 	
-	class index_images_context;
+	// Determines which of the discovered files are indexed.
+	class image_path_filter
+	{
+	protected:
+		std::regex								m_name_regex;
+		std::string								m_image_root;
+		pi::shard_spec							m_shard;
+		
+	public:
+		image_path_filter(std::string const &image_root, pi::shard_spec const &shard):
+			m_name_regex("\\.ORF$", std::regex_constants::icase),
+			m_image_root(image_root),
+			m_shard(shard)
+		{
+		}
+		
+		bool matches(std::string const &path) const { return std::regex_search(path, m_name_regex) && is_in_shard(path); }
+		
+	protected:
+		bool is_in_shard(std::string const &path) const;
+	};
 	
 	
-	// Maintain the directory tree iteration state.
-	class process_directory_state
+	// Source of the paths to be indexed.
+	class image_source
 	{
+	public:
+		virtual ~image_source() {}
+		virtual bool next_image(image_path_filter const &filter, pi::scheduled_image &image) = 0;
+	};
+	
+	
+	// Maintain the directory tree iteration state. The sidecars of each directory are determined
+	// from a listing made when the directory is entered.
+	class process_directory_state final : public image_source
+	{
+	protected:
+		struct directory_frame
+		{
+			fs::directory_iterator				iterator;
+			pi::directory_sidecars				sidecars;
+		};
+		
 	protected:
-		fs::recursive_directory_iterator		m_directory_iterator;
+		std::vector <directory_frame>			m_directories;	// The innermost last.
+		fs::path								m_root;
+		bool									m_is_started{};
 		
 	public:
 		process_directory_state() = default;
 		
 		process_directory_state(std::string const &path):
-			m_directory_iterator(fs::recursive_directory_iterator(path))
+			m_root(path)
 		{
 		}
 		
-		bool advance_and_call(index_images_context &ctx);
+		bool next_image(image_path_filter const &filter, pi::scheduled_image &image) override;
+		
+	protected:
+		void enter_directory(fs::path const &directory);
 	};
 	
 	
-	enum processing_state : std::uint8_t
+	// Read the paths from a list separated by newlines or NUL characters, e.g. a manifest written
+	// with --scan-only.
+	class path_list_state final : public image_source
 	{
-		PROCESSING,
-		WAITING_FOR_WORKER,
-		DRAINING
+	protected:
+		std::ifstream							m_file_stream;
+		std::istream							*m_stream{};
+		std::string								m_record;
+		char									m_separator{};
+		
+	public:
+		explicit path_list_state(char const separator):
+			m_stream(&std::cin),
+			m_separator(separator)
+		{
+		}
+		
+		// Reads from stdin if path is “-”.
+		bool open(std::string const &path);
+		bool next_image(image_path_filter const &filter, pi::scheduled_image &image) override;
+	};
+	
+	
+	std::size_t core_count() { return std::max(1U, std::thread::hardware_concurrency()); }
+	
+	
+	// Bounds and state of adjusting the number of workers by hill climbing on the throughput.
+	struct worker_tuning
+	{
+		// One adjustment, for the run summary.
+		struct record
+		{
+			std::chrono::seconds	elapsed{};
+			double					images_per_second{};
+			double					stalled_fraction{};
+			std::size_t				previous_count{};
+			std::size_t				new_count{};
+			char const				*reason{};
+		};
+		
+		std::vector <record>		records;
+		std::chrono::steady_clock::time_point	start_time{};
+		std::chrono::steady_clock::time_point	previous_time{};
+		std::size_t					min_workers{1};
+		std::size_t					max_workers{1};
+		std::size_t					previous_images{};
+		double						previous_throughput{};
+		std::uint32_t				interval{};		// Seconds.
+		int							direction{1};	// Of the next adjustment, zero if converged.
+		
+		// Determine the next worker count from the throughput and the fraction of time the workers
+		// spent waiting for the database or for new images. The count is not increased unless
+		// can_grow is true. Applied changes are recorded.
+		std::size_t adjust(std::size_t const current, std::size_t const images, std::uint64_t const stalled_ns, bool const can_grow);
+	};
+	
+	
+	struct index_images_options
+	{
+		std::string								image_root;
+		std::string								database_path;
+		std::string								paths_from;
+		pi::shard_spec							shard;
+		std::unique_ptr <pi::work_claims>		claims;
+		pi::decode_worker_limits				decode_limits;
+		worker_tuning							tuning;
+		std::size_t								worker_count{};
+		bool									adaptive_workers{};
+		std::size_t								claim_batch_size{};
+		double									sequence_gap{};
+		bool									metadata_only{};
+		bool									isolate_decoding{};
+		bool									retry_failures{};
+		char									path_separator{'\n'};
+		pi::processing_order					order{pi::processing_order::TRAVERSAL};
+		std::uint16_t							project_name_from_parent{};
 	};
 	
 	
@@ -55,265 +199,1094 @@ namespace {
 	{
 	protected:
 		typedef std::unique_ptr <pi::raw_processor>	processor_ptr;
-		typedef std::list <processor_ptr>			processor_list_type;
+		typedef std::vector <processor_ptr>			processor_vector;
+		typedef std::array <
+			pi::string_dictionary,
+			pi::DICTIONARY_COLUMN_COUNT
+		>											dictionary_array;
 		
 	protected:
 		sqlite::database							m_db;
-		process_directory_state						m_dir_state;
-		std::regex									m_name_regex;
+		pi::work_stealing_queue						m_queue;
+		std::unique_ptr <pi::work_claims>			m_claims;
+		std::vector <std::int64_t>					m_completed_work_items;
+		std::vector <std::uint32_t>					m_histogram_buffer;	// For storing the histograms.
+		std::mutex									m_db_mutex;		// Protects the databases, the dictionaries, the quarantine and the completed work items.
+		std::mutex									m_refill_mutex;
+		std::mutex									m_workers_mutex;	// Protects m_is_worker_running.
+		std::atomic <std::size_t>					m_images_in_flight{};
+		std::atomic <std::size_t>					m_active_workers{};		// Workers with greater indices exit.
+		std::atomic <std::uint64_t>					m_stalled_ns{};			// Time spent waiting for the database or for images.
+		std::atomic <std::size_t>					m_images_processed{};	// Stored successfully.
+		std::atomic <std::size_t>					m_images_failed{};
+		std::size_t									m_images_skipped{};
+		std::atomic <std::uint64_t>					m_steady_state_allocations{};
+		dispatch_group_t							m_group{};
+		dispatch_source_t							m_heartbeat_timer{};
+		dispatch_source_t							m_tuning_timer{};
+		image_path_filter							m_path_filter;
 		std::string									m_image_root;
-		processor_list_type							m_processors;
-		processor_list_type							m_pending_processors;
-		processing_state							m_state{PROCESSING};
+		std::string									m_paths_from;
+		processor_vector							m_processors;	// One for each worker.
+		std::vector <bool>							m_is_worker_running;
+		worker_tuning								m_tuning;
+		dictionary_array							m_dictionaries;
+		pi::decode_worker_limits					m_decode_limits;	// Used by the processors if decoding is isolated.
+		pi::failure_quarantine						m_quarantine;
+		pi::sidecar_cache							m_sidecar_cache;	// For the images not found by traversing the directories. Protected by m_refill_mutex after starting.
+		std::unordered_set <std::string>			m_sequence_directories;	// Directories whose sequences need to be reassigned.
+		std::size_t									m_claim_batch_size{};
+		double										m_sequence_gap{};
 		std::uint16_t								m_project_name_from_parent{};
-		
-	protected:
-		static constexpr std::size_t processor_count() { return 16; }
+		bool										m_in_transaction{};
+		bool										m_metadata_only{};
+		bool										m_retry_failures{};
+		bool										m_adaptive_workers{};
+		bool										m_all_images_queued{};	// True if the queue will not be refilled.
+		char										m_path_separator{};
+		pi::processing_order						m_order{};
 		
 	public:
-		index_images_context(std::string const &image_root, std::string const &database_path, std::uint16_t project_name_from_parent):
-			m_db(database_path),
-			m_name_regex("\\.ORF$", std::regex_constants::icase),
-			m_image_root(image_root),
-			m_processors(processor_count()),
-			m_project_name_from_parent(project_name_from_parent)
+		explicit index_images_context(index_images_options &&options):
+			m_db(options.database_path),
+			m_queue(options.adaptive_workers ? options.tuning.max_workers : options.worker_count),
+			m_claims(std::move(options.claims)),
+			m_active_workers(options.worker_count),
+			m_path_filter(options.image_root, options.shard),
+			m_image_root(options.image_root),
+			m_paths_from(options.paths_from),
+			m_processors(m_queue.worker_count()),
+			m_is_worker_running(m_queue.worker_count(), false),
+			m_tuning(options.tuning),
+			m_decode_limits(options.decode_limits),
+			m_claim_batch_size(options.claim_batch_size),
+			m_sequence_gap(options.sequence_gap),
+			m_project_name_from_parent(options.project_name_from_parent),
+			m_metadata_only(options.metadata_only),
+			m_retry_failures(options.retry_failures),
+			m_adaptive_workers(options.adaptive_workers),
+			m_path_separator(options.path_separator),
+			m_order(options.order)
 		{
 			for (auto &ptr : m_processors)
-				ptr.reset(pi::raw_processor::instantiate());
+			{
+				if (options.isolate_decoding)
+					ptr.reset(new pi::isolated_raw_processor(m_decode_limits));
+				else
+					ptr.reset(pi::raw_processor::instantiate());
+			}
 			
 			// Try to save time.
 			m_db << u8"PRAGMA journal_mode = OFF;";
 			
 			// Set up the schema.
-			m_db << u8""
-				"CREATE TABLE IF NOT EXISTS image (				"
-				"	id					INTEGER PRIMARY KEY,	"
-				"	project				TEXT,					"
-				"	filename			TEXT,					"
-				"	timestamp			INTEGER,				"
-				"	artist				TEXT,					"
-				"	copyright			TEXT,					"
-				"	make				TEXT,					"
-				"	model				TEXT,					"
-				"	lens_model			TEXT,					"
-				"	aperture			REAL,					"
-				"	focal_length		REAL,					"
-				"	iso					REAL,					"
-				"	exposure_time_n		INTEGER,				"
-				"	exposure_time_d		INTEGER,				"
-				"	exposure_program	INTEGER,				"
-				"	flash				INTEGER,				"
-				"	rank				INTEGER,				"
-				"	preview				BLOB					"
-				");												"
-			"";
-		}
-		
-		std::regex const &get_name_regex() const { return m_name_regex; }
+			pi::prepare_schema(m_db);
+			
+			// Read the existing dictionary values.
+			for (std::size_t i(0); i < pi::DICTIONARY_COLUMN_COUNT; ++i)
+				m_dictionaries[i].load(m_db, pi::dictionary_column_names[i]);
+			
+			// Read the files that failed previously.
+			m_quarantine.load(m_db);
+		}
 		
 		void start_processing();
-		void process_next();
-		
-		inline processor_ptr pick_processor();
-		inline void return_processor(processor_ptr &ptr);
-		
-		void process_path(std::string const &path);
 		void finish();
 		
 	protected:
 		void cleanup() { delete this; }
-		inline void queue_process_next();
+		void start_workers();
+		void start_worker(std::size_t const worker_idx);
+		bool should_retire(std::size_t const worker_idx);
+		void run_worker(std::size_t const worker_idx);
+		void start_tuning();
+		void tune_worker_count();
+		void set_active_workers(std::size_t const count);
+		void report_tuning() const;
+		std::uint16_t thread_count_for_next_image() const;
+		bool refill_queue();
+		void discover_paths();
+		void start_heartbeat();
+		void flush_completed_work_items();
+		void assign_sequences();
+		void handle_processed_image(pi::raw_processor const &proc, pi::scheduled_image const &image);
+		void store_image(pi::raw_processor const &proc, std::string const &path);
+		bool is_quarantined(pi::scheduled_image const &image) const { return !m_retry_failures && m_quarantine.contains(image); }
+		std::int64_t dictionary_id(pi::dictionary_column const column, std::string const &value) { return m_dictionaries[column].id(m_db, value); }
 		std::string_view project_name(std::string const &path) const;
 	};
 	
 	
-	// Find the next image file and call the processing function.
-	bool process_directory_state::advance_and_call(index_images_context &ctx)
+	// Bind the GPS position or NULLs.
+	void bind_gps_position(sqlite::database_binder &stmt, pi::gps_position const &gps)
 	{
-		while (true)
+		if (gps.has_coordinates)
+			stmt << gps.signed_latitude() << gps.signed_longitude();
+		else
+			stmt << nullptr << nullptr;
+		
+		if (gps.has_altitude)
+			stmt << gps.signed_altitude();
+		else
+			stmt << nullptr;
+	}
+	
+	
+	// Bind the UTC timestamp in microseconds or NULL.
+	void bind_utc_timestamp(sqlite::database_binder &stmt, pi::exif_properties const &exif_data)
+	{
+		if (auto const timestamp_us(exif_data.utc_timestamp_us()); timestamp_us)
+			stmt << timestamp_us;
+		else
+			stmt << nullptr;
+	}
+	
+	
+	// Bind the perceptual hashes or NULLs. SQLite does not have an unsigned integer type.
+	void bind_hashes(sqlite::database_binder &stmt, pi::perceptual_hashes const &hashes)
+	{
+		if (hashes.is_valid)
+			stmt << std::int64_t(hashes.phash) << std::int64_t(hashes.dhash);
+		else
+			stmt << nullptr << nullptr;
+	}
+	
+	
+	// Bind the exposure statistics or NULLs. The histograms are stored as little-endian 32-bit integers.
+	void bind_exposure_statistics(sqlite::database_binder &stmt, pi::exposure_statistics const &stats, std::vector <std::uint32_t> &histogram_buffer)
+	{
+		if (!stats.is_valid)
 		{
-			if (fs::recursive_directory_iterator() == m_directory_iterator)
-				return false;
+			stmt << nullptr << nullptr << nullptr << nullptr;
+			return;
+		}
+		
+		histogram_buffer.resize(stats.histograms.size());
+		std::transform(stats.histograms.begin(), stats.histograms.end(), histogram_buffer.begin(), [](auto const val){
+			return boost::endian::native_to_little(val);
+		});
+		stmt << stats.clipped_fraction << stats.dark_fraction << stats.mean_luminance << histogram_buffer;
+	}
+	
+	
+	// Determine the size, the modification time and the inode number. These are only used for
+	// scheduling and the manifest, so errors may be ignored.
+	void stat_image(pi::scheduled_image &image)
+	{
+		struct stat sb{};
+		if (0 == stat(image.path.c_str(), &sb))
+		{
+			image.size = sb.st_size;
+			image.mtime = sb.st_mtime;
+			image.inode = sb.st_ino;
+		}
+		else
+		{
+			image.size = 0;
+			image.mtime = 0;
+			image.inode = 0;
+		}
+	}
+	
+	
+	// Determine the sidecars from the listing and start iterating the directory.
+	void process_directory_state::enter_directory(fs::path const &directory)
+	{
+		directory_frame frame{fs::directory_iterator(directory), {}};
+		for (auto const &entry : fs::directory_iterator(directory))
+		{
+			if (!entry.is_directory() || entry.is_symlink())
+				frame.sidecars.add_entry(entry.path().filename().u8string());
+		}
+		
+		frame.sidecars.finish();
+		m_directories.push_back(std::move(frame));
+	}
+	
+	
+	// Find the next image file and determine its size. The entries are visited depth-first in
+	// the listing order, like recursive_directory_iterator does, and symbolic links to directories
+	// are not followed.
+	bool process_directory_state::next_image(image_path_filter const &filter, pi::scheduled_image &image)
+	{
+		if (!m_is_started)
+		{
+			m_is_started = true;
+			if (!m_root.empty())
+				enter_directory(m_root);
+		}
+		
+		while (!m_directories.empty())
+		{
+			auto &frame(m_directories.back());
+			if (fs::directory_iterator() == frame.iterator)
+			{
+				m_directories.pop_back();
+				continue;
+			}
+			
+			auto const entry(*frame.iterator);
+			++frame.iterator;
 			
-			auto const &entry(*m_directory_iterator);
-			auto const &path(entry.path());
-			auto const &path_str(path.u8string());
+			if (entry.is_directory() && !entry.is_symlink())
+			{
+				// Invalidates frame.
+				enter_directory(entry.path());
+				continue;
+			}
 			
-			if (std::regex_search(path_str, ctx.get_name_regex()))
+			auto path_str(entry.path().u8string());
+			if (filter.matches(path_str))
 			{
-				ctx.process_path(path_str);
-				++m_directory_iterator;
+				image.sidecars = frame.sidecars.flags(path_str);
+				image.path = std::move(path_str);
+				image.work_item_id = 0;
+				stat_image(image);
 				return true;
 			}
+		}
+		
+		return false;
+	}
+	
+	
+	bool path_list_state::open(std::string const &path)
+	{
+		if ("-" == path)
+		{
+			m_stream = &std::cin;
+			return true;
+		}
+		
+		m_file_stream.open(path);
+		m_stream = &m_file_stream;
+		return m_file_stream.is_open();
+	}
+	
+	
+	// Remove the size and the modification time if the record was written by write_manifest().
+	// They are located from the end, since the path may contain tabs.
+	void remove_manifest_fields(std::string &record)
+	{
+		auto const is_integer([](std::string_view const sv){
+			auto const digits(sv.substr(!sv.empty() && '-' == sv.front()));
+			return !digits.empty() && std::all_of(digits.begin(), digits.end(), [](char const cc){ return '0' <= cc && cc <= '9'; });
+		});
+		
+		auto const mtime_pos(record.rfind('\t'));
+		if (std::string::npos == mtime_pos || 0 == mtime_pos)
+			return;
+		
+		auto const size_pos(record.rfind('\t', mtime_pos - 1));
+		if (std::string::npos == size_pos)
+			return;
+		
+		std::string_view const sv(record);
+		if (is_integer(sv.substr(1 + size_pos, mtime_pos - size_pos - 1)) && is_integer(sv.substr(1 + mtime_pos)))
+			record.resize(size_pos);
+	}
+	
+	
+	// Read the next path from the list.
+	bool path_list_state::next_image(image_path_filter const &filter, pi::scheduled_image &image)
+	{
+		while (std::getline(*m_stream, m_record, m_separator))
+		{
+			remove_manifest_fields(m_record);
+			
+			if (m_record.empty() || !filter.matches(m_record))
+				continue;
 			
-			++m_directory_iterator;
+			image.path = m_record;
+			image.work_item_id = 0;
+			image.sidecars = pi::SIDECAR_UNKNOWN;	// Determined by the caller if needed.
+			stat_image(image);
+			return true;
 		}
 		
-		// Should not be reached.
-		libbio_fail("One of the return statements in the while loop should be reached.");
 		return false;
 	}
 	
 	
-	// Start the processing loop.
+	// Either walk the directory tree or read the given list.
+	std::unique_ptr <image_source> open_image_source(std::string const &image_root, std::string const &paths_from, char const separator)
+	{
+		if (paths_from.empty())
+			return std::make_unique <process_directory_state>(image_root);
+		
+		auto retval(std::make_unique <path_list_state>(separator));
+		if (!retval->open(paths_from))
+		{
+			std::cerr << "Unable to open " << paths_from << ": " << std::strerror(errno) << '\n';
+			std::exit(EXIT_FAILURE);
+		}
+		return retval;
+	}
+	
+	
+	pi::processing_order parse_processing_order(char const *name)
+	{
+		if (0 == strcmp("size", name))
+			return pi::processing_order::SIZE;
+		if (0 == strcmp("inode", name))
+			return pi::processing_order::INODE;
+		if (0 == strcmp("extent", name))
+			return pi::processing_order::EXTENT;
+		if (0 == strcmp("newest", name))
+			return pi::processing_order::NEWEST;
+		return pi::processing_order::TRAVERSAL;
+	}
+	
+	
+	// Write the paths of the images that would be indexed with their sizes and modification times.
+	// Paths that contain the separator cannot be read back, so they are skipped; --null avoids this.
+	void write_manifest(image_source &source, image_path_filter const &filter, char const separator, std::ostream &os)
+	{
+		pi::scheduled_image image;
+		while (source.next_image(filter, image))
+		{
+			if (std::string::npos != image.path.find(separator))
+			{
+				std::cerr << "Skipping a path that contains the record separator; use --null to include it: " << image.path << '\n';
+				continue;
+			}
+			
+			os << image.path << '\t' << image.size << '\t' << image.mtime << separator;
+		}
+		os << std::flush;
+	}
+	
+	
+	std::size_t worker_tuning::adjust(std::size_t const current, std::size_t const images, std::uint64_t const stalled_ns, bool const can_grow)
+	{
+		auto const now(std::chrono::steady_clock::now());
+		auto const seconds(std::chrono::duration <double>(now - previous_time).count());
+		auto const throughput((images - previous_images) / seconds);
+		auto const stalled_fraction(std::min(1.0, stalled_ns / (1e9 * seconds * current)));
+		auto const had_throughput(0 < previous_throughput);
+		auto const ratio(had_throughput ? throughput / previous_throughput : 1.0);
+		previous_time = now;
+		previous_images = images;
+		previous_throughput = throughput;
+		
+		// Continue in the same direction while the throughput improves and turn back if it drops.
+		// If the change is within the noise, the count has converged until the throughput changes.
+		// Workers that mostly wait for the database or for new images do not help.
+		char const *reason{};
+		if (0.25 < stalled_fraction)
+		{
+			direction = -1;
+			reason = "stalled";
+		}
+		else if (!had_throughput)
+			reason = "initial";
+		else if (ratio < 0.95)
+		{
+			direction = (direction ? -direction : 1);
+			reason = "throughput decreased";
+		}
+		else if (1.05 < ratio)
+		{
+			if (!direction)
+				direction = 1;
+			reason = "throughput increased";
+		}
+		else
+		{
+			direction = 0;
+			return current;
+		}
+		
+		auto const next(std::clamp(std::size_t(std::max(std::ptrdiff_t(1), std::ptrdiff_t(current) + direction)), min_workers, max_workers));
+		if (current < next && !can_grow)
+		{
+			// Try again from the current count once there is work for more workers.
+			direction = 0;
+			return current;
+		}
+		
+		if (next != current)
+		{
+			auto const elapsed(std::chrono::duration_cast <std::chrono::seconds>(now - start_time));
+			records.push_back({elapsed, throughput, stalled_fraction, current, next, reason});
+		}
+		return next;
+	}
+	
+	
+	// Start the processing.
 	void index_images_context::start_processing()
 	{
 		// Processing entry point.
-		m_dir_state = process_directory_state(m_image_root);
-		if (!m_dir_state.advance_and_call(*this))
+		if (m_claims)
 		{
-			std::cerr << "Did not find any suitable files.\n";
-			finish();
+			// The queue is filled by the workers as they run out of images.
+			discover_paths();
+			start_heartbeat();
+		}
+		else
+		{
+			// Determine the images and their sizes before processing.
+			std::vector <pi::scheduled_image> images;
+			auto const source(open_image_source(m_image_root, m_paths_from, m_path_separator));
+			pi::scheduled_image image;
+			while (source->next_image(m_path_filter, image))
+			{
+				if (is_quarantined(image))
+					++m_images_skipped;
+				else
+				{
+					if (pi::SIDECAR_UNKNOWN == image.sidecars)
+						image.sidecars = m_sidecar_cache.flags(image.path);
+					images.emplace_back(std::move(image));
+				}
+			}
+			
+			if (images.empty())
+			{
+				std::cerr << "Did not find any suitable files.\n";
+				finish();
+			}
+			
+			pi::sort_images(images, m_order);
+			m_queue.distribute(std::move(images));
+			m_all_images_queued = true;
 		}
+		
+		start_workers();
 	}
 	
 	
-	// Attempt to advance the directory tree iteration.
-	void index_images_context::process_next()
+	// Start one worker for each processor and finish when all of them are done.
+	void index_images_context::start_workers()
 	{
-		// If there are no more images to process, drain the queue.
-		if (!m_dir_state.advance_and_call(*this))
-			m_state = processing_state::DRAINING;
+		m_group = dispatch_group_create();
+		set_active_workers(m_active_workers);
+		
+		dispatch_group_notify_f(m_group, dispatch_get_main_queue(), this, [](void *ctx){
+			static_cast <index_images_context *>(ctx)->finish();
+		});
+		
+		if (m_adaptive_workers)
+			start_tuning();
 	}
 	
 	
-	// Queue the advancing function.
-	void index_images_context::queue_process_next()
+	// m_workers_mutex needs to be held.
+	void index_images_context::start_worker(std::size_t const worker_idx)
 	{
-		lb::dispatch(this).async <&index_images_context::process_next>(dispatch_get_main_queue());
+		m_is_worker_running[worker_idx] = true;
+		auto *queue(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0));
+		lb::dispatch_group_async_fn(m_group, queue, [this, worker_idx](){ run_worker(worker_idx); });
 	}
 	
 	
-	// Clean up.
-	void index_images_context::finish()
+	// Change the number of workers. The workers that are no longer needed exit after their current image.
+	void index_images_context::set_active_workers(std::size_t const count)
 	{
-		cleanup();
-		// this no longer valid.
-		std::exit(EXIT_SUCCESS);
+		std::lock_guard lock(m_workers_mutex);
+		m_active_workers = count;
+		for (std::size_t i(0); i < count; ++i)
+		{
+			if (!m_is_worker_running[i])
+				start_worker(i);
+		}
 	}
 	
 	
-	// Process the image at the given path.
-	void index_images_context::process_path(std::string const &path)
+	// Check whether the given worker should exit because the number of workers was reduced.
+	bool index_images_context::should_retire(std::size_t const worker_idx)
 	{
-		// Callback (from process_directory_state::advance_and_call).
-		std::cerr << path << std::endl;
+		if (worker_idx < m_active_workers)
+			return false;
 		
-		// Get an image processor and move it to the pending list.
-		auto current_proc(pick_processor());
-		current_proc->prepare_file(path);
-		lb::dispatch_async_fn(dispatch_get_global_queue(QOS_CLASS_UTILITY, 0), [this, path, current_proc{std::move(current_proc)}]() mutable {
-			current_proc->process_image();
-			lb::dispatch_async_fn(dispatch_get_main_queue(), [this, path, current_proc{std::move(current_proc)}]() mutable {
+		// Check again in case the count was just increased.
+		std::lock_guard lock(m_workers_mutex);
+		if (worker_idx < m_active_workers)
+			return false;
+		
+		m_is_worker_running[worker_idx] = false;
+		return true;
+	}
+	
+	
+	// Process images until there are none left.
+	void index_images_context::run_worker(std::size_t const worker_idx)
+	{
+		auto &proc(*m_processors[worker_idx]);
+		pi::scheduled_image image;
+		bool is_warmed_up(false);
+		while (true)
+		{
+			if (should_retire(worker_idx))
+				return;
+			
+			if (m_queue.pop(worker_idx, image))
+			{
+				++m_images_in_flight;
+				proc.set_thread_count(thread_count_for_next_image());
+				proc.set_sidecars(image.sidecars);
 				
-				auto const &exif_data(current_proc->get_exif_properties());
-				auto const &dop_data(current_proc->get_dop_properties());
-				auto const &project(project_name(path));
+				// Count the allocations made by the processor after its first image.
+				auto const allocation_count(pi::thread_allocation_count());
+				if (m_metadata_only)
+					proc.read_metadata(image.path);
+				else if (proc.prepare_file(image.path))
+					proc.process_image();
+				if (is_warmed_up)
+					m_steady_state_allocations += pi::thread_allocation_count() - allocation_count;
+				is_warmed_up = true;
 				
-				// Handle the processed data.
-				try
+				handle_processed_image(proc, image);
+				--m_images_in_flight;
+			}
+			else
+			{
+				auto const wait_start(std::chrono::steady_clock::now());
+				auto const did_refill(refill_queue());
+				m_stalled_ns += std::chrono::duration_cast <std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wait_start).count();
+				
+				if (!did_refill)
 				{
-					m_db
-						<< u8"INSERT INTO image ("
-						"filename, project, timestamp, artist, copyright, make, model, lens_model, aperture, "
-						"focal_length, exposure_time_n, exposure_time_d, iso, exposure_program, flash, rank, preview"
-						") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);"
-						<< path
-						<< std::string(project)
-						<< exif_data.timestamp
-						<< exif_data.artist
-						<< exif_data.copyright
-						<< exif_data.make
-						<< exif_data.model
-						<< exif_data.lens_model
-						<< exif_data.aperture
-						<< exif_data.focal_length
-						<< exif_data.exposure_time.first
-						<< exif_data.exposure_time.second
-						<< exif_data.iso_speed
-						<< exif_data.exposure_program
-						<< exif_data.flash
-						<< dop_data.rank
-						<< current_proc->get_buffer();
+					std::lock_guard lock(m_workers_mutex);
+					m_is_worker_running[worker_idx] = false;
+					return;
 				}
-				catch (sqlite::sqlite_exception const &exc)
+			}
+		}
+	}
+	
+	
+	// Measure the throughput periodically and adjust the number of workers.
+	void index_images_context::start_tuning()
+	{
+		m_tuning.start_time = std::chrono::steady_clock::now();
+		m_tuning.previous_time = m_tuning.start_time;
+		
+		m_tuning_timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+		dispatch_set_context(m_tuning_timer, this);
+		dispatch_source_set_event_handler_f(m_tuning_timer, [](void *ctx){
+			static_cast <index_images_context *>(ctx)->tune_worker_count();
+		});
+		
+		auto const interval(std::uint64_t(m_tuning.interval) * NSEC_PER_SEC);
+		dispatch_source_set_timer(m_tuning_timer, dispatch_time(DISPATCH_TIME_NOW, interval), interval, NSEC_PER_SEC);
+		dispatch_resume(m_tuning_timer);
+	}
+	
+	
+	// Called on the main queue.
+	void index_images_context::tune_worker_count()
+	{
+		// New workers would have nothing to do if the queue is empty. (Also, all of the workers
+		// may have exited already.)
+		auto const current(m_active_workers.load());
+		auto const next(m_tuning.adjust(current, m_images_processed, m_stalled_ns.exchange(0), !m_queue.empty()));
+		if (next != current)
+			set_active_workers(next);
+	}
+	
+	
+	void index_images_context::report_tuning() const
+	{
+		if (!m_adaptive_workers)
+			return;
+		
+		std::cerr << "Worker count adjustments (" << m_tuning.records.size() << "):\n";
+		for (auto const &record : m_tuning.records)
+		{
+			std::cerr
+				<< "  " << record.elapsed.count() << " s: "
+				<< record.previous_count << " → " << record.new_count << " workers; "
+				<< record.images_per_second << " images/s, "
+				<< (100.0 * record.stalled_fraction) << " % stalled; "
+				<< record.reason << '\n';
+		}
+		std::cerr << "Final worker count: " << m_active_workers << '\n';
+	}
+	
+	
+	// Determine the number of OpenMP threads for the image that was just taken from the queue.
+	// While there are at least as many images left as there are workers, each image is processed
+	// with one thread. After that, the cores are divided among the images that are still being
+	// processed, so that the last few images finish sooner. In claims mode more images may arrive
+	// after the queue has been exhausted, so one thread is always used.
+	std::uint16_t index_images_context::thread_count_for_next_image() const
+	{
+		if (!m_all_images_queued)
+			return 1;
+		
+		auto const workers(m_active_workers.load());
+		auto const queued(m_queue.size());
+		if (workers <= queued)
+			return 1;
+		
+		auto const images(std::max(std::size_t(1), queued + m_images_in_flight.load()));
+		auto const retval(std::clamp(core_count() / images, std::size_t(1), core_count()));
+		return std::min(retval, std::size_t(UINT16_MAX));
+	}
+	
+	
+	// Claim more images when the queue has been exhausted. Returns false if there is nothing left to do.
+	bool index_images_context::refill_queue()
+	{
+		if (!m_claims)
+			return false;
+		
+		std::lock_guard refill_lock(m_refill_mutex);
+		while (true)
+		{
+			// Another worker may have refilled the queue in the meantime.
+			if (!m_queue.empty())
+				return true;
+			
+			std::vector <pi::work_item> items;
+			bool is_discovery_finished(false);
+			{
+				std::lock_guard lock(m_db_mutex);
+				if (!m_claims->claim(m_claim_batch_size * m_active_workers, items))
+					is_discovery_finished = m_claims->is_discovery_finished();
+			}
+			
+			if (!items.empty())
+			{
+				std::vector <pi::scheduled_image> images;
+				images.reserve(items.size());
+				for (auto &item : items)
 				{
-					std::cerr << "Caught an SQLite exception: " << exc.get_code() << ' ' << exc.get_extended_code() << ' ' << exc.what() << '\n';
+					auto &image(images.emplace_back());
+					image.path = std::move(item.path);
+					image.work_item_id = item.id;
+					image.sidecars = m_sidecar_cache.flags(image.path);
+					stat_image(image);
 				}
 				
-				// Return the processor.
-				return_processor(current_proc);
-				
-				switch (m_state)
+				// Mark the quarantined images done without processing them.
 				{
-					case processing_state::PROCESSING:
-						return;
-					
-					case processing_state::WAITING_FOR_WORKER:
-					{
-						m_state = processing_state::PROCESSING;
-						queue_process_next();
-						return;
-					}
-					
-					case processing_state::DRAINING:
-					{
-						// Check if the last task just finished.
-						if (m_pending_processors.empty())
-							finish();
-						return;
-					}
+					std::lock_guard lock(m_db_mutex);
+					auto const it(std::remove_if(images.begin(), images.end(), [this](auto const &image){
+						if (!is_quarantined(image))
+							return false;
+						
+						++m_images_skipped;
+						m_completed_work_items.push_back(image.work_item_id);
+						return true;
+					}));
+					images.erase(it, images.end());
 				}
-			});
+				
+				// Try again if all of the claimed images were skipped.
+				if (images.empty())
+					continue;
+				
+				// Each claimed batch is ordered separately.
+				pi::sort_images(images, m_order);
+				m_queue.distribute(std::move(images));
+				return true;
+			}
+			
+			if (is_discovery_finished)
+				return false;
+			
+			// The paths are still being discovered, possibly after the previous discoverer’s lease expired.
+			discover_paths();
+			std::this_thread::sleep_for(std::chrono::seconds(5));
+		}
+	}
+	
+	
+	// Fill the claims table if no other process is doing that.
+	void index_images_context::discover_paths()
+	{
+		{
+			std::lock_guard lock(m_db_mutex);
+			if (!m_claims->begin_discovery())
+				return;
+		}
+		
+		std::cerr << "Discovering the image paths…\n";
+		
+		// Add the paths in batches to extend the discovery lease in between.
+		std::size_t const batch_size(1024);
+		std::vector <std::string> paths;
+		auto const source(open_image_source(m_image_root, m_paths_from, m_path_separator));
+		pi::scheduled_image image;
+		while (source->next_image(m_path_filter, image))
+		{
+			paths.emplace_back(std::move(image.path));
+			if (batch_size == paths.size())
+			{
+				std::lock_guard lock(m_db_mutex);
+				m_claims->add_paths(paths);
+				paths.clear();
+			}
+		}
+		
+		std::lock_guard lock(m_db_mutex);
+		m_claims->add_paths(paths);
+		m_claims->end_discovery();
+	}
+	
+	
+	// Extend the leases of the claimed items periodically.
+	void index_images_context::start_heartbeat()
+	{
+		m_heartbeat_timer = dispatch_source_create(DISPATCH_SOURCE_TYPE_TIMER, 0, 0, dispatch_get_main_queue());
+		dispatch_set_context(m_heartbeat_timer, this);
+		dispatch_source_set_event_handler_f(m_heartbeat_timer, [](void *ctx){
+			auto &self(*static_cast <index_images_context *>(ctx));
+			try
+			{
+				std::lock_guard lock(self.m_db_mutex);
+				self.m_claims->heartbeat();
+			}
+			catch (sqlite::sqlite_exception const &exc)
+			{
+				std::cerr << "Unable to extend the leases: " << exc.get_code() << ' ' << exc.get_extended_code() << ' ' << exc.what() << '\n';
+			}
 		});
 		
-		switch (m_state)
+		auto const interval(m_claims->lease_seconds() * NSEC_PER_SEC / 3);
+		dispatch_source_set_timer(m_heartbeat_timer, dispatch_time(DISPATCH_TIME_NOW, interval), interval, NSEC_PER_SEC);
+		dispatch_resume(m_heartbeat_timer);
+	}
+	
+	
+	// Commit the images and mark the corresponding work items done. m_db_mutex needs to be held.
+	void index_images_context::flush_completed_work_items()
+	{
+		if (m_in_transaction)
+		{
+			m_db << u8"COMMIT;";
+			m_in_transaction = false;
+		}
+		
+		if (m_claims)
+		{
+			m_claims->mark_done(m_completed_work_items);
+			m_completed_work_items.clear();
+		}
+	}
+	
+	
+	// Group the images in the directories that had new or updated images. m_db_mutex needs to be held.
+	void index_images_context::assign_sequences()
+	{
+		if (m_sequence_directories.empty())
+			return;
+		
+		std::cerr << "Grouping the images into sequences…\n";
+		try
+		{
+			m_db << u8"BEGIN;";
+			for (auto const &directory : m_sequence_directories)
+				pi::assign_sequences(m_db, directory, m_sequence_gap);
+			m_db << u8"COMMIT;";
+		}
+		catch (sqlite::sqlite_exception const &exc)
 		{
-			case processing_state::PROCESSING:
+			std::cerr << "Caught an SQLite exception: " << exc.get_code() << ' ' << exc.get_extended_code() << ' ' << exc.what() << '\n';
+			m_db << u8"ROLLBACK;";
+		}
+		
+		m_sequence_directories.clear();
+	}
+	
+	
+	// Clean up.
+	void index_images_context::finish()
+	{
+		if (m_heartbeat_timer)
+		{
+			dispatch_source_cancel(m_heartbeat_timer);
+			dispatch_release(m_heartbeat_timer);
+			m_heartbeat_timer = nullptr;
+		}
+		
+		if (m_tuning_timer)
+		{
+			dispatch_source_cancel(m_tuning_timer);
+			dispatch_release(m_tuning_timer);
+			m_tuning_timer = nullptr;
+		}
+		
+		if (m_group)
+		{
+			dispatch_release(m_group);
+			m_group = nullptr;
+		}
+		
+		{
+			std::lock_guard lock(m_db_mutex);
+			flush_completed_work_items();
+			assign_sequences();
+		}
+		
+		// Summary.
+		std::cerr << "Processed " << m_images_processed << " images.\n";
+		if (m_images_failed)
+			std::cerr << "Unable to process " << m_images_failed << " images; see --list-failures.\n";
+		if (m_images_skipped)
+			std::cerr << "Skipped " << m_images_skipped << " unchanged images that could not be processed before; use --retry-failures to process them.\n";
+		report_tuning();
+		if (pi::counts_allocations())
+			std::cerr << "Heap allocations by the processors after warm-up: " << m_steady_state_allocations << '\n';
+		
+		cleanup();
+		// this no longer valid.
+		std::exit(EXIT_SUCCESS);
+	}
+	
+	
+	// Store the result of processing the given image.
+	void index_images_context::handle_processed_image(pi::raw_processor const &proc, pi::scheduled_image const &image)
+	{
+		auto const wait_start(std::chrono::steady_clock::now());
+		std::lock_guard lock(m_db_mutex);
+		m_stalled_ns += std::chrono::duration_cast <std::chrono::nanoseconds>(std::chrono::steady_clock::now() - wait_start).count();
+		
+		try
+		{
+			// When claiming work, the results are committed in batches before marking the items done.
+			if (m_claims && !m_in_transaction)
 			{
-				// If there are no more processors available, wait.
-				// Otherwise, get the next path.
-				if (m_processors.empty())
-					m_state = processing_state::WAITING_FOR_WORKER;
-				else
-					queue_process_next();
-				return;
+				m_db << u8"BEGIN;";
+				m_in_transaction = true;
 			}
 			
-			case processing_state::WAITING_FOR_WORKER:
-			case processing_state::DRAINING:
-				return;
+			// Record the failure instead of storing an incomplete row.
+			auto const &failure(proc.get_failure());
+			if (failure.has_failed())
+			{
+				++m_images_failed;
+				std::cerr << "*** Unable to process " << image.path << " (" << pi::to_string(failure.stage) << "): " << failure.message << '\n';
+				m_quarantine.record(m_db, image, failure);
+			}
+			else
+			{
+				store_image(proc, image.path);
+				++m_images_processed;
+				m_quarantine.remove(m_db, image.path, !m_metadata_only);
+				
+				auto const pos(image.path.find_last_of('/'));
+				m_sequence_directories.emplace(image.path, 0, std::string::npos == pos ? 0 : pos);
+			}
+		}
+		catch (sqlite::sqlite_exception const &exc)
+		{
+			std::cerr << "Caught an SQLite exception: " << exc.get_code() << ' ' << exc.get_extended_code() << ' ' << exc.what() << '\n';
+		}
+		
+		if (image.work_item_id)
+		{
+			m_completed_work_items.push_back(image.work_item_id);
+			if (m_claim_batch_size <= m_completed_work_items.size())
+			{
+				try
+				{
+					flush_completed_work_items();
+				}
+				catch (sqlite::sqlite_exception const &exc)
+				{
+					std::cerr << "Caught an SQLite exception: " << exc.get_code() << ' ' << exc.get_extended_code() << ' ' << exc.what() << '\n';
+				}
+			}
 		}
 	}
 	
 	
-	// Get an image processor from the processor list.
-	auto index_images_context::pick_processor() -> processor_ptr
+	// Write the processed data to the database. m_db_mutex needs to be held.
+	void index_images_context::store_image(pi::raw_processor const &proc, std::string const &path)
 	{
-		processor_ptr retval;
+		auto const &exif_data(proc.get_exif_properties());
+		auto const &dop_data(proc.get_dop_properties());
+		auto const &project(project_name(path));
+		auto const &preview(proc.get_buffer());
+		auto const &thumbnail(proc.get_thumbnail());
+		auto const &hashes(proc.get_hashes());
+		auto const &exposure_stats(proc.get_exposure_statistics());
 		
-		libbio_assert(!m_processors.empty());
-		auto proc_it(m_processors.begin());
+		// Look up the dictionary-encoded values first.
+		std::string const project_str(project);
+		auto const project_id(dictionary_id(pi::PROJECT, project_str));
+		auto const artist_id(dictionary_id(pi::ARTIST, exif_data.artist));
+		auto const copyright_id(dictionary_id(pi::COPYRIGHT, exif_data.copyright));
+		auto const make_id(dictionary_id(pi::MAKE, exif_data.make));
+		auto const model_id(dictionary_id(pi::MODEL, exif_data.model));
+		auto const lens_model_id(dictionary_id(pi::LENS_MODEL, exif_data.lens_model));
 		
-		using std::swap;
-		swap(*proc_it, retval);
-		libbio_assert(!*proc_it);
+		// Update the existing row if there is one. When refreshing the metadata, the preview and
+		// its hashes are retained.
+		std::int64_t row_id(0);
+		std::unique_ptr <std::int64_t> old_phash;
+		m_db << u8"SELECT id, phash FROM image_record WHERE filename = ? LIMIT 1;" << path
+			>> [&row_id, &old_phash](std::int64_t const id, std::unique_ptr <std::int64_t> phash){
+				row_id = id;
+				old_phash = std::move(phash);
+			};
 		
-		m_pending_processors.splice(m_pending_processors.end(), m_processors, proc_it);
-		return retval;
+		if (row_id)
+		{
+			// The old content is needed for removing the row from the full-text index.
+			m_db
+				<< u8"INSERT INTO image_fts ("
+				"image_fts, rowid, filename, project, artist, copyright, make, model, lens_model"
+				") SELECT 'delete', id, filename, project, artist, copyright, make, model, lens_model FROM image WHERE id = ?;"
+				<< row_id;
+			
+			auto stmt(m_db << (
+				std::string(
+					"UPDATE image_record SET "
+					"project_id = ?, timestamp = ?, timestamp_us = ?, artist_id = ?, copyright_id = ?, make_id = ?, model_id = ?, lens_model_id = ?, "
+					"aperture = ?, focal_length = ?, exposure_time_n = ?, exposure_time_d = ?, iso = ?, exposure_program = ?, "
+					"flash = ?, rank = ?, orientation = ?, body_serial = ?, lens_serial = ?, shutter_count = ?, "
+					"gps_latitude = ?, gps_longitude = ?, gps_altitude = ? "
+				) +
+				(m_metadata_only ? "" : ", phash = ?, dhash = ?, clipped_fraction = ?, dark_fraction = ?, mean_luminance = ?, raw_histogram = ?, thumbnail = ?, preview = ? ") +
+				"WHERE id = ?;"
+			));
+			
+			stmt
+				<< project_id
+				<< exif_data.timestamp;
+			bind_utc_timestamp(stmt, exif_data);
+			stmt
+				<< artist_id
+				<< copyright_id
+				<< make_id
+				<< model_id
+				<< lens_model_id
+				<< exif_data.aperture
+				<< exif_data.focal_length
+				<< exif_data.exposure_time.first
+				<< exif_data.exposure_time.second
+				<< exif_data.iso_speed
+				<< exif_data.exposure_program
+				<< exif_data.flash
+				<< dop_data.rank
+				<< exif_data.orientation
+				<< exif_data.body_serial
+				<< exif_data.lens_serial
+				<< exif_data.shutter_count;
+			bind_gps_position(stmt, exif_data.gps);
+			
+			if (!m_metadata_only)
+			{
+				bind_hashes(stmt, hashes);
+				bind_exposure_statistics(stmt, exposure_stats, m_histogram_buffer);
+				
+				if (thumbnail.empty())
+					stmt << nullptr;
+				else
+					stmt << thumbnail;
+				
+				if (preview.empty())
+					stmt << nullptr;
+				else
+					stmt << preview;
+				
+				if (old_phash)
+					pi::remove_from_similarity_index(m_db, row_id, *old_phash);
+				if (hashes.is_valid)
+					pi::add_to_similarity_index(m_db, row_id, hashes.phash);
+			}
+			
+			// Executed at the end of the scope.
+			stmt << row_id;
+		}
+		else
+		{
+			{
+				auto stmt(m_db
+					<< u8"INSERT INTO image_record ("
+					"filename, project_id, timestamp, timestamp_us, artist_id, copyright_id, make_id, model_id, lens_model_id, aperture, "
+					"focal_length, exposure_time_n, exposure_time_d, iso, exposure_program, flash, rank, orientation, "
+					"body_serial, lens_serial, shutter_count, gps_latitude, gps_longitude, gps_altitude, phash, dhash, "
+					"clipped_fraction, dark_fraction, mean_luminance, raw_histogram, thumbnail, preview"
+					") VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?);"
+				);
+				
+				stmt
+					<< path
+					<< project_id
+					<< exif_data.timestamp;
+				bind_utc_timestamp(stmt, exif_data);
+				stmt
+					<< artist_id
+					<< copyright_id
+					<< make_id
+					<< model_id
+					<< lens_model_id
+					<< exif_data.aperture
+					<< exif_data.focal_length
+					<< exif_data.exposure_time.first
+					<< exif_data.exposure_time.second
+					<< exif_data.iso_speed
+					<< exif_data.exposure_program
+					<< exif_data.flash
+					<< dop_data.rank
+					<< exif_data.orientation
+					<< exif_data.body_serial
+					<< exif_data.lens_serial
+					<< exif_data.shutter_count;
+				bind_gps_position(stmt, exif_data.gps);
+				bind_hashes(stmt, hashes);
+				bind_exposure_statistics(stmt, exposure_stats, m_histogram_buffer);
+				
+				if (thumbnail.empty())
+					stmt << nullptr;
+				else
+					stmt << thumbnail;
+				
+				// Executed at the end of the scope.
+				if (preview.empty())
+					stmt << nullptr;
+				else
+					stmt << preview;
+			}
+			
+			row_id = m_db.last_insert_rowid();
+			
+			if (hashes.is_valid)
+				pi::add_to_similarity_index(m_db, row_id, hashes.phash);
+		}
+		
+		// Keep the full-text index up to date.
+		m_db
+			<< u8"INSERT INTO image_fts ("
+			"rowid, filename, project, artist, copyright, make, model, lens_model"
+			") VALUES (?, ?, ?, ?, ?, ?, ?, ?);"
+			<< row_id
+			<< path
+			<< project_str
+			<< exif_data.artist
+			<< exif_data.copyright
+			<< exif_data.make
+			<< exif_data.model
+			<< exif_data.lens_model;
 	}
 	
 	
-	// Return an image processor to the list.
-	void index_images_context::return_processor(processor_ptr &ptr)
+	// Check whether the image belongs to this instance’s shard. The directory is hashed relative to
+	// the image root, so the partition does not depend on where the tree is mounted.
+	bool image_path_filter::is_in_shard(std::string const &path) const
 	{
-		auto proc_it(m_pending_processors.begin());
+		if (1 == m_shard.count)
+			return true;
+		
+		std::string_view root(m_image_root);
+		while (1 < root.size() && '/' == root.back())
+			root.remove_suffix(1);
 		
-		using std::swap;
-		swap(*proc_it, ptr);
-		libbio_assert(!ptr);
+		std::string_view dir(path);
+		auto const pos(dir.find_last_of('/'));
+		dir = dir.substr(0, std::string_view::npos == pos ? 0 : pos);
+		if (0 == dir.compare(0, root.size(), root))
+			dir.remove_prefix(root.size());
+		while (!dir.empty() && '/' == dir.front())
+			dir.remove_prefix(1);
 		
-		m_processors.splice(m_processors.begin(), m_pending_processors, proc_it);
+		return m_shard.contains_directory(dir);
 	}
 	
 	
@@ -359,18 +1332,313 @@ namespace {
 
 int main(int argc, char **argv)
 {
+	// Decoding process started by isolated_raw_processor.
+	if (3 == argc && 0 == strcmp(pi::DECODE_WORKER_ARGUMENT, argv[1]))
+		return pi::run_decode_worker(std::strtoull(argv[2], nullptr, 10));
+	
 	gengetopt_args_info args_info;
 	if (0 != cmdline_parser(argc, argv, &args_info))
 		exit(EXIT_FAILURE);
-
+	
 	std::ios_base::sync_with_stdio(false);	// Don't use C style IO after calling cmdline_parser.
+	
+	if (args_info.sequence_gap_arg < 0)
+	{
+		std::cerr << "The sequence gap must be non-negative.\n";
+		std::exit(EXIT_FAILURE);
+	}
 
 #ifndef NDEBUG
 	std::cerr << "Assertions have been enabled." << std::endl;
 #endif
 	
+	if (args_info.query_mode_counter)
+	{
+		pi::query_arguments query_args;
+		if (args_info.project_given)
+			query_args.project = args_info.project_arg;
+		if (args_info.lens_given)
+			query_args.lens_model = args_info.lens_arg;
+		if (args_info.text_given)
+			query_args.text = args_info.text_arg;
+		if (args_info.since_given)
+			query_args.since = args_info.since_arg;
+		if (args_info.until_given)
+			query_args.until = args_info.until_arg;
+		if (args_info.min_rank_given)
+			query_args.min_rank = args_info.min_rank_arg;
+		if (args_info.max_clipped_given)
+			query_args.max_clipped = args_info.max_clipped_arg;
+		if (args_info.max_dark_given)
+			query_args.max_dark = args_info.max_dark_arg;
+		if (args_info.min_luminance_given)
+			query_args.min_luminance = args_info.min_luminance_arg;
+		if (args_info.sequence_given)
+			query_args.sequence_id = args_info.sequence_arg;
+		if (args_info.limit_given)
+			query_args.limit = args_info.limit_arg;
+		if (0 == strcmp("json", args_info.format_arg))
+			query_args.format = pi::output_format::JSON;
+		if (args_info.similar_to_given)
+			query_args.similar_to = args_info.similar_to_arg;
+		
+		if (args_info.max_distance_arg < 0 || 16 < args_info.max_distance_arg)
+		{
+			std::cerr << "Maximum distance must be between 0 and 16.\n";
+			std::exit(EXIT_FAILURE);
+		}
+		query_args.max_distance = args_info.max_distance_arg;
+		
+		try
+		{
+			sqlite::database db(args_info.database_arg, sqlite::sqlite_config{sqlite::OpenFlags::READONLY});
+			if (args_info.list_failures_flag)
+				pi::run_failure_report(db, query_args, std::cout);
+			else if (query_args.similar_to)
+				pi::run_similarity_query(db, query_args, std::cout);
+			else
+				pi::run_query(db, query_args, std::cout);
+		}
+		catch (sqlite::sqlite_exception const &exc)
+		{
+			std::cerr << "Caught an SQLite exception: " << exc.get_code() << ' ' << exc.get_extended_code() << ' ' << exc.what() << '\n';
+			std::exit(EXIT_FAILURE);
+		}
+		
+		cmdline_parser_free(&args_info);
+		return EXIT_SUCCESS;
+	}
+	
+	if (args_info.stats_mode_counter)
+	{
+		try
+		{
+			sqlite::database db(args_info.database_arg, sqlite::sqlite_config{sqlite::OpenFlags::READONLY});
+			pi::run_summary_report(db, args_info.dimension_given ? args_info.dimension_arg : "", pi::output_format::TSV, std::cout);
+		}
+		catch (sqlite::sqlite_exception const &exc)
+		{
+			std::cerr << "Caught an SQLite exception: " << exc.get_code() << ' ' << exc.get_extended_code() << ' ' << exc.what() << '\n';
+			std::exit(EXIT_FAILURE);
+		}
+		
+		cmdline_parser_free(&args_info);
+		return EXIT_SUCCESS;
+	}
+	
+	if (args_info.export_mode_counter)
+	{
+		auto const format(0 == strcmp("parquet", args_info.export_format_arg) ? pi::export_format::PARQUET : pi::export_format::COLUMN_CHUNKS);
+		if (!pi::can_export(format))
+		{
+			std::cerr << "Parquet support has not been enabled.\n";
+			std::exit(EXIT_FAILURE);
+		}
+		
+		if (args_info.row_group_size_arg <= 0)
+		{
+			std::cerr << "Row group size must be positive.\n";
+			std::exit(EXIT_FAILURE);
+		}
+		
+		try
+		{
+			sqlite::database db(args_info.database_arg, sqlite::sqlite_config{sqlite::OpenFlags::READONLY});
+			pi::export_metadata(db, args_info.export_arg, format, args_info.row_group_size_arg);
+		}
+		catch (sqlite::sqlite_exception const &exc)
+		{
+			std::cerr << "Caught an SQLite exception: " << exc.get_code() << ' ' << exc.get_extended_code() << ' ' << exc.what() << '\n';
+			std::exit(EXIT_FAILURE);
+		}
+		catch (std::exception const &exc)
+		{
+			std::cerr << "Unable to export the metadata: " << exc.what() << '\n';
+			std::exit(EXIT_FAILURE);
+		}
+		
+		cmdline_parser_free(&args_info);
+		return EXIT_SUCCESS;
+	}
+	
+	if (args_info.merge_mode_counter)
+	{
+		std::vector <std::string> shard_paths(args_info.merge_arg, args_info.merge_arg + args_info.merge_given);
+		
+		try
+		{
+			sqlite::database db(args_info.database_arg);
+			pi::merge_shards(db, shard_paths, args_info.sequence_gap_arg);
+		}
+		catch (sqlite::sqlite_exception const &exc)
+		{
+			std::cerr << "Caught an SQLite exception: " << exc.get_code() << ' ' << exc.get_extended_code() << ' ' << exc.what() << '\n';
+			std::exit(EXIT_FAILURE);
+		}
+		
+		cmdline_parser_free(&args_info);
+		return EXIT_SUCCESS;
+	}
+	
+	if (args_info.serve_mode_counter)
+	{
+		if (args_info.port_arg <= 0 || UINT16_MAX < args_info.port_arg)
+		{
+			std::cerr << "Invalid port number.\n";
+			std::exit(EXIT_FAILURE);
+		}
+		
+		if (args_info.cache_size_arg < 0)
+		{
+			std::cerr << "Cache size must be non-negative.\n";
+			std::exit(EXIT_FAILURE);
+		}
+		
+		pi::serve_arguments serve_args;
+		serve_args.database_path = args_info.database_arg;
+		serve_args.port = args_info.port_arg;
+		serve_args.cache_size = std::size_t(args_info.cache_size_arg) * 1024 * 1024;
+		if (args_info.socket_given)
+			serve_args.socket_path = args_info.socket_arg;
+		
+		try
+		{
+			pi::serve_previews(serve_args);
+		}
+		catch (std::exception const &exc)
+		{
+			std::cerr << "Unable to serve the previews: " << exc.what() << '\n';
+			std::exit(EXIT_FAILURE);
+		}
+		
+		cmdline_parser_free(&args_info);
+		return EXIT_SUCCESS;
+	}
+	
+	if (!args_info.image_root_given && !args_info.paths_from_given)
+	{
+		std::cerr << "Either --image-root or --paths-from is required for indexing.\n";
+		std::exit(EXIT_FAILURE);
+	}
+	
+	pi::shard_spec shard;
+	if (args_info.shard_given && !shard.parse(args_info.shard_arg))
+	{
+		std::cerr << "Unable to parse the shard specification.\n";
+		std::exit(EXIT_FAILURE);
+	}
+	
+	std::string const image_root(args_info.image_root_given ? args_info.image_root_arg : "");
+	std::string const paths_from(args_info.paths_from_given ? args_info.paths_from_arg : "");
+	char const path_separator(args_info.null_flag ? '\0' : '\n');
+	
+	if (args_info.scan_only_flag)
+	{
+		image_path_filter const filter(image_root, shard);
+		auto const source(open_image_source(image_root, paths_from, path_separator));
+		write_manifest(*source, filter, path_separator, std::cout);
+		cmdline_parser_free(&args_info);
+		return EXIT_SUCCESS;
+	}
+	
+	index_images_options options;
+	options.image_root = image_root;
+	options.paths_from = paths_from;
+	options.path_separator = path_separator;
+	options.order = parse_processing_order(args_info.order_arg);
+	options.database_path = args_info.database_arg;
+	options.shard = shard;
+	options.project_name_from_parent = args_info.project_name_from_parent_arg;
+	options.metadata_only = args_info.metadata_only_flag;
+	options.retry_failures = args_info.retry_failures_flag;
+	
+	options.worker_count = core_count();
+	if (args_info.workers_given)
+	{
+		if (0 == std::strcmp(args_info.workers_arg, "auto"))
+		{
+			if (args_info.min_workers_arg <= 0 || args_info.max_workers_arg < 0 || args_info.tuning_interval_arg <= 0)
+			{
+				std::cerr << "The minimum number of workers and the tuning interval must be positive and the maximum number of workers non-negative.\n";
+				std::exit(EXIT_FAILURE);
+			}
+			
+			auto &tuning(options.tuning);
+			tuning.min_workers = args_info.min_workers_arg;
+			tuning.max_workers = (args_info.max_workers_arg ? std::size_t(args_info.max_workers_arg) : 2 * core_count());
+			tuning.interval = args_info.tuning_interval_arg;
+			if (tuning.max_workers < tuning.min_workers)
+			{
+				std::cerr << "The maximum number of workers must not be less than the minimum.\n";
+				std::exit(EXIT_FAILURE);
+			}
+			
+			options.adaptive_workers = true;
+			options.worker_count = std::clamp(options.worker_count, tuning.min_workers, tuning.max_workers);
+		}
+		else
+		{
+			char *end{};
+			errno = 0;
+			auto const count(std::strtoul(args_info.workers_arg, &end, 10));
+			if (errno || '\0' != *end || end == args_info.workers_arg || 0 == count)
+			{
+				std::cerr << "The number of workers must be a positive integer or “auto”.\n";
+				std::exit(EXIT_FAILURE);
+			}
+			options.worker_count = count;
+		}
+	}
+	
+	options.sequence_gap = args_info.sequence_gap_arg;
+	
+	if (args_info.isolate_decoding_flag)
+	{
+		if (args_info.decode_timeout_arg <= 0 || args_info.decode_memory_limit_arg < 0)
+		{
+			std::cerr << "The decoding time limit must be positive and the memory limit non-negative.\n";
+			std::exit(EXIT_FAILURE);
+		}
+		
+		// A worker may exit while a request is being sent to it; this is handled where the write fails.
+		std::signal(SIGPIPE, SIG_IGN);
+		
+		options.isolate_decoding = true;
+		options.decode_limits.executable_path = argv[0];
+		options.decode_limits.timeout = args_info.decode_timeout_arg;
+		options.decode_limits.memory_limit = std::uint64_t(args_info.decode_memory_limit_arg) * 1024 * 1024;
+	}
+	
+	if (args_info.claims_database_given)
+	{
+		if (args_info.shard_given)
+		{
+			std::cerr << "--shard and --claims-database are mutually exclusive.\n";
+			std::exit(EXIT_FAILURE);
+		}
+		
+		if (args_info.lease_time_arg <= 0 || args_info.claim_batch_size_arg <= 0)
+		{
+			std::cerr << "The lease time and the claim batch size must be positive.\n";
+			std::exit(EXIT_FAILURE);
+		}
+		
+		std::string worker_id;
+		if (args_info.worker_id_given)
+			worker_id = args_info.worker_id_arg;
+		else
+		{
+			char hostname[256]{};
+			gethostname(hostname, sizeof(hostname) - 1);
+			worker_id = std::string(hostname) + ':' + std::to_string(getpid());
+		}
+		
+		options.claims.reset(new pi::work_claims(args_info.claims_database_arg, worker_id, args_info.lease_time_arg));
+		options.claim_batch_size = args_info.claim_batch_size_arg;
+	}
+	
 	// Guard for exceptions while starting by using a unique_ptr.
-	std::unique_ptr <index_images_context> ctx(new index_images_context(args_info.image_root_arg, args_info.database_arg, args_info.project_name_from_parent_arg));
+	std::unique_ptr <index_images_context> ctx(new index_images_context(std::move(options)));
 	lb::dispatch_async_fn(dispatch_get_main_queue(), [ctx{std::move(ctx)}]() mutable {
 		ctx->start_processing();
 		ctx.release(); // Don’t deallocate.
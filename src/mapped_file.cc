@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "mapped_file.hh"
+
+
+namespace index_images {
+	
+	bool mapped_file::open(std::string const &path)
+	{
+		close();
+		
+		auto const fd(::open(path.c_str(), O_RDONLY));
+		if (-1 == fd)
+			return false;
+		
+		struct stat sb{};
+		auto const res(fstat(fd, &sb));
+		if (-1 == res || 0 == sb.st_size)
+		{
+			// Empty files cannot be mapped (nor contain an image).
+			auto const error(-1 == res ? errno : EINVAL);
+			::close(fd);
+			errno = error;
+			return false;
+		}
+		
+		// The mapping remains valid after closing the file descriptor.
+		auto *data(mmap(nullptr, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0));
+		auto const error(errno);
+		::close(fd);
+		if (MAP_FAILED == data)
+		{
+			errno = error;
+			return false;
+		}
+		
+		madvise(data, sb.st_size, MADV_RANDOM);
+		m_data = data;
+		m_size = sb.st_size;
+		return true;
+	}
+	
+	
+	void mapped_file::close()
+	{
+		if (m_data)
+		{
+			munmap(m_data, m_size);
+			m_data = nullptr;
+			m_size = 0;
+		}
+	}
+}
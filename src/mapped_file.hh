@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_MAPPED_FILE_HH
+#define INDEX_IMAGES_MAPPED_FILE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+namespace index_images {
+	
+	// Read-only memory mapping of a whole file. Access is expected to be random, so the kernel
+	// is asked not to read ahead; only the touched pages are read from the disk.
+	class mapped_file
+	{
+	protected:
+		void			*m_data{};
+		std::size_t		m_size{};
+		
+	public:
+		mapped_file() = default;
+		~mapped_file() { close(); }
+		
+		mapped_file(mapped_file const &) = delete;
+		mapped_file &operator=(mapped_file const &) = delete;
+		
+		// Sets errno on failure; EINVAL if the file is empty.
+		bool open(std::string const &path);
+		void close();
+		
+		std::uint8_t const *data() const { return static_cast <std::uint8_t const *>(m_data); }
+		std::size_t size() const { return m_size; }
+	};
+}
+
+#endif
@@ -0,0 +1,159 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include "merge.hh"
+#include "schema.hh"
+#include "sequences.hh"
+
+
+namespace {
+	
+	namespace ii = index_images;
+	
+	
+	// Directories and the first database that had images in each of them.
+	typedef std::unordered_map <std::string, std::size_t>	directory_map;
+	
+	
+	// Note the directories of the images in the given table. The sequences of a directory need to be
+	// reassigned if its images came from more than one database, e.g. when claim batches split a
+	// burst between hosts.
+	void add_directories(
+		sqlite::database &db,
+		char const *table,
+		std::size_t const database_idx,
+		directory_map &directories,
+		std::unordered_set <std::string> &split_directories
+	)
+	{
+		db << (std::string("SELECT filename FROM ") + table + ";")
+			>> [database_idx, &directories, &split_directories](std::string const &filename){
+				auto const pos(filename.find_last_of('/'));
+				std::string directory(filename, 0, std::string::npos == pos ? 0 : pos);
+				auto const res(directories.emplace(directory, database_idx));
+				if (!res.second && res.first->second != database_idx)
+					split_directories.emplace(std::move(directory));
+			};
+	}
+	
+	
+	void merge_shard(
+		sqlite::database &db,
+		std::string const &shard_path,
+		std::size_t const database_idx,
+		directory_map &directories,
+		std::unordered_set <std::string> &split_directories
+	)
+	{
+		db << u8"ATTACH DATABASE ? AS shard;" << shard_path;
+		
+		try
+		{
+			add_directories(db, "shard.image_record", database_idx, directories, split_directories);
+			
+			db << u8"BEGIN;";
+			
+			// Add the missing dictionary values and join with both the shard’s lookup table
+			// and the merged one to get the new identifier.
+			std::string insert_columns(ii::image_record_value_columns);
+			std::string select_columns(ii::image_record_value_columns);
+			std::string joins;
+			
+			// The sequence identifiers are only unique within a database.
+			std::int64_t sequence_offset(0);
+			db << u8"SELECT IFNULL(MAX(sequence_id), 0) FROM main.image_record;" >> sequence_offset;
+			insert_columns += ", sequence_id";
+			select_columns += ", r.sequence_id + " + std::to_string(sequence_offset);
+			for (auto const *name : ii::dictionary_column_names)
+			{
+				std::string const table(std::string("lookup_") + name);
+				std::string const shard_alias(std::string("s_") + name);
+				std::string const main_alias(std::string("m_") + name);
+				
+				db << ("INSERT OR IGNORE INTO main." + table + " (value) SELECT value FROM shard." + table + ";");
+				
+				insert_columns += std::string(", ") + name + "_id";
+				select_columns += ", " + main_alias + ".id";
+				joins += " LEFT JOIN shard." + table + " " + shard_alias + " ON " + shard_alias + ".id = r." + name + "_id";
+				joins += " LEFT JOIN main." + table + " " + main_alias + " ON " + main_alias + ".value = " + shard_alias + ".value";
+			}
+			
+			// If a claim lease expired while the original host was still processing the batch,
+			// both hosts may have stored the image. Keep the first copy.
+			db << (
+				"INSERT INTO main.image_record (" + insert_columns + ") "
+				"SELECT " + select_columns + " FROM shard.image_record r" + joins +
+				" WHERE NOT EXISTS (SELECT 1 FROM main.image_record m WHERE m.filename = r.filename);"
+			);
+			
+			// Shards indexed before the failure table was added do not have it.
+			int has_failure_table(0);
+			db << u8"SELECT COUNT(*) FROM shard.sqlite_master WHERE type = 'table' AND name = 'failure';" >> has_failure_table;
+			if (has_failure_table)
+			{
+				db
+					<< u8"INSERT OR REPLACE INTO main.failure (filename, stage, error_code, message, file_size, file_mtime, recorded_at) "
+					"SELECT filename, stage, error_code, message, file_size, file_mtime, recorded_at FROM shard.failure;";
+			}
+			
+			db << u8"COMMIT;";
+		}
+		catch (...)
+		{
+			db << u8"ROLLBACK;";
+			db << u8"DETACH DATABASE shard;";
+			throw;
+		}
+		
+		db << u8"DETACH DATABASE shard;";
+	}
+}
+
+
+namespace index_images {
+	
+	void merge_shards(sqlite::database &db, std::vector <std::string> const &shard_paths, double const sequence_gap)
+	{
+		prepare_schema(db);
+		
+		directory_map directories;
+		std::unordered_set <std::string> split_directories;
+		add_directories(db, "main.image_record", 0, directories, split_directories);
+		
+		// Inserting without the indices and creating them afterwards is faster.
+		// The same applies to maintaining the summary.
+		// The filename index is needed for skipping the images that have already been merged.
+		drop_indices(db);
+		create_filename_index(db);
+		drop_summary_triggers(db);
+		
+		// The target database is number zero.
+		for (std::size_t i(0); i < shard_paths.size(); ++i)
+		{
+			std::cerr << "Merging " << shard_paths[i] << "…\n";
+			merge_shard(db, shard_paths[i], 1 + i, directories, split_directories);
+		}
+		
+		std::cerr << "Rebuilding the indices…\n";
+		create_indices(db);
+		rebuild_full_text_index(db);
+		rebuild_similarity_index(db);
+		rebuild_summary(db);
+		create_summary_triggers(db);
+		
+		if (!split_directories.empty())
+		{
+			std::cerr << "Reassigning the sequences in " << split_directories.size() << " directories…\n";
+			db << u8"BEGIN;";
+			for (auto const &directory : split_directories)
+				assign_sequences(db, directory, sequence_gap);
+			db << u8"COMMIT;";
+		}
+	}
+}
@@ -0,0 +1,23 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_MERGE_HH
+#define INDEX_IMAGES_MERGE_HH
+
+#include <sqlite_modern_cpp.h>
+#include <string>
+#include <vector>
+
+
+namespace index_images {
+	
+	// Copy the images from the shard databases to db. The dictionary identifiers are remapped
+	// and the row identifiers are reassigned. Images whose filenames are already present are
+	// skipped. The indices are rebuilt once at the end. The sequences of the directories whose
+	// images came from more than one database are reassigned with the given gap.
+	void merge_shards(sqlite::database &db, std::vector <std::string> const &shard_paths, double const sequence_gap);
+}
+
+#endif
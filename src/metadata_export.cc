@@ -0,0 +1,555 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <boost/endian/conversion.hpp>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <libbio/assert.hh>
+#include <libbio/utility.hh>
+#include <limits>
+#include <memory>
+#include <vector>
+#include "metadata_export.hh"
+
+#ifdef INDEX_IMAGES_HAVE_PARQUET
+#	include <arrow/api.h>
+#	include <arrow/io/file.h>
+#	include <parquet/arrow/writer.h>
+#	include <parquet/exception.h>
+#endif
+
+
+namespace {
+	
+	namespace ii = index_images;
+	namespace end = boost::endian;
+	
+	
+	struct column_spec
+	{
+		char const		*name{};
+		ii::column_type	type{};
+	};
+	
+	
+	// Exported columns in the order of the image view.
+	column_spec const columns[]{
+		{"id",					ii::column_type::INT64},
+		{"project",				ii::column_type::STRING},
+		{"filename",			ii::column_type::STRING},
+		{"timestamp",			ii::column_type::INT64},
+		{"artist",				ii::column_type::STRING},
+		{"copyright",			ii::column_type::STRING},
+		{"make",				ii::column_type::STRING},
+		{"model",				ii::column_type::STRING},
+		{"lens_model",			ii::column_type::STRING},
+		{"aperture",			ii::column_type::FLOAT64},
+		{"focal_length",		ii::column_type::FLOAT64},
+		{"iso",					ii::column_type::FLOAT64},
+		{"exposure_time_n",		ii::column_type::INT64},
+		{"exposure_time_d",		ii::column_type::INT64},
+		{"exposure_program",	ii::column_type::INT64},
+		{"flash",				ii::column_type::INT64},
+		{"rank",				ii::column_type::INT64},
+		{"orientation",			ii::column_type::INT64},
+		{"body_serial",			ii::column_type::STRING},
+		{"lens_serial",			ii::column_type::STRING},
+		{"shutter_count",		ii::column_type::INT64},
+		{"gps_latitude",		ii::column_type::FLOAT64},
+		{"gps_longitude",		ii::column_type::FLOAT64},
+		{"gps_altitude",		ii::column_type::FLOAT64},
+		{"clipped_fraction",	ii::column_type::FLOAT64},
+		{"dark_fraction",		ii::column_type::FLOAT64},
+		{"mean_luminance",		ii::column_type::FLOAT64},
+		{"sequence_id",			ii::column_type::INT64},
+		{"timestamp_us",		ii::column_type::INT64}
+	};
+	
+	constexpr std::size_t column_count{sizeof(columns) / sizeof(columns[0])};
+	constexpr std::size_t project_column{1};
+	constexpr std::size_t timestamp_column{3};
+	constexpr char const magic[]{"IIMCOL02"};
+	
+	
+	struct column_buffer
+	{
+		std::vector <std::int64_t>	integers;
+		std::vector <double>		reals;
+		std::vector <std::uint32_t>	offsets{0};
+		std::vector <std::uint8_t>	validity;	// One bit per row, least significant first.
+		std::string					characters;
+		
+		void clear()
+		{
+			integers.clear();
+			reals.clear();
+			offsets.resize(1);
+			validity.clear();
+			characters.clear();
+		}
+		
+		bool is_valid(std::size_t const row) const { return validity[row / 8] & (1U << (row % 8)); }
+		
+		void push_validity(std::size_t const row, bool const is_valid)
+		{
+			if (0 == row % 8)
+				validity.push_back(0);
+			if (is_valid)
+				validity.back() |= (1U << (row % 8));
+		}
+	};
+	
+	
+	struct row_group
+	{
+		std::vector <column_buffer>	columns{column_count};
+		std::uint32_t				row_count{};
+		std::int64_t				min_timestamp{std::numeric_limits <std::int64_t>::max()};
+		std::int64_t				max_timestamp{std::numeric_limits <std::int64_t>::min()};
+		std::string					min_project;
+		std::string					max_project;
+		bool						has_project{};
+		
+		void clear();
+		void update_statistics();
+		std::string_view string_value(std::size_t const column, std::size_t const row) const;
+	};
+	
+	
+	class export_writer
+	{
+	public:
+		virtual ~export_writer() {}
+		virtual void write_row_group(row_group const &rg) = 0;
+		virtual void finish() = 0;
+	};
+	
+	
+	// Writer for the built-in format.
+	class column_chunk_writer final : public export_writer
+	{
+	protected:
+		struct row_group_info
+		{
+			std::uint32_t					row_count{};
+			std::int64_t					min_timestamp{};
+			std::int64_t					max_timestamp{};
+			std::string						min_project;
+			std::string						max_project;
+			std::vector <std::uint64_t>		chunk_offsets;
+			std::vector <std::uint64_t>		chunk_lengths;
+		};
+		
+	protected:
+		std::ofstream					m_stream;
+		std::vector <row_group_info>	m_row_groups;
+		
+	public:
+		explicit column_chunk_writer(std::string const &path);
+		void write_row_group(row_group const &rg) override;
+		void finish() override;
+		
+	protected:
+		template <typename t_value>
+		void write_value(t_value const value);
+		void write_string(std::string const &str);
+		template <typename t_value>
+		void write_values(std::vector <t_value> const &values);
+	};
+
+
+#ifdef INDEX_IMAGES_HAVE_PARQUET
+	// Writer for Parquet. The row group statistics are written by the library.
+	class parquet_writer final : public export_writer
+	{
+	protected:
+		std::shared_ptr <arrow::Schema>					m_schema;
+		std::shared_ptr <arrow::io::FileOutputStream>	m_stream;
+		std::unique_ptr <parquet::arrow::FileWriter>	m_writer;
+		
+	public:
+		explicit parquet_writer(std::string const &path);
+		void write_row_group(row_group const &rg) override;
+		void finish() override;
+	};
+#endif
+	
+	
+	void row_group::clear()
+	{
+		for (auto &col : columns)
+			col.clear();
+		
+		row_count = 0;
+		min_timestamp = std::numeric_limits <std::int64_t>::max();
+		max_timestamp = std::numeric_limits <std::int64_t>::min();
+		min_project.clear();
+		max_project.clear();
+		has_project = false;
+	}
+	
+	
+	std::string_view row_group::string_value(std::size_t const column, std::size_t const row) const
+	{
+		auto const &col(columns[column]);
+		auto const begin(col.offsets[row]);
+		return std::string_view(col.characters).substr(begin, col.offsets[1 + row] - begin);
+	}
+	
+	
+	// Update the statistics from the last row.
+	void row_group::update_statistics()
+	{
+		libbio_assert(row_count);
+		auto const row_idx(row_count - 1);
+		
+		if (columns[timestamp_column].is_valid(row_idx))
+		{
+			auto const timestamp(columns[timestamp_column].integers[row_idx]);
+			min_timestamp = std::min(min_timestamp, timestamp);
+			max_timestamp = std::max(max_timestamp, timestamp);
+		}
+		
+		if (columns[project_column].is_valid(row_idx))
+		{
+			auto const project(string_value(project_column, row_idx));
+			if (!has_project || project < min_project)
+				min_project = project;
+			if (!has_project || max_project < project)
+				max_project = project;
+			has_project = true;
+		}
+	}
+	
+	
+	column_chunk_writer::column_chunk_writer(std::string const &path)
+	{
+		m_stream.exceptions(std::ofstream::failbit | std::ofstream::badbit);
+		m_stream.open(path, std::ios_base::out | std::ios_base::trunc | std::ios_base::binary);
+		m_stream.write(magic, sizeof(magic) - 1);
+	}
+	
+	
+	template <typename t_value>
+	void column_chunk_writer::write_value(t_value const value)
+	{
+		auto const le_value(end::native_to_little(value));
+		m_stream.write(reinterpret_cast <char const *>(&le_value), sizeof(t_value));
+	}
+	
+	
+	template <>
+	void column_chunk_writer::write_value(double const value)
+	{
+		static_assert(sizeof(double) == sizeof(std::uint64_t));
+		std::uint64_t bits{};
+		std::memcpy(&bits, &value, sizeof(double));
+		write_value(bits);
+	}
+	
+	
+	void column_chunk_writer::write_string(std::string const &str)
+	{
+		write_value(std::uint32_t(str.size()));
+		m_stream.write(str.data(), str.size());
+	}
+	
+	
+	template <typename t_value>
+	void column_chunk_writer::write_values(std::vector <t_value> const &values)
+	{
+		if (end::order::native == end::order::little && sizeof(t_value) == sizeof(std::uint64_t))
+			m_stream.write(reinterpret_cast <char const *>(values.data()), values.size() * sizeof(t_value));
+		else
+		{
+			for (auto const val : values)
+				write_value(val);
+		}
+	}
+	
+	
+	void column_chunk_writer::write_row_group(row_group const &rg)
+	{
+		auto &info(m_row_groups.emplace_back());
+		info.row_count = rg.row_count;
+		info.min_timestamp = rg.min_timestamp;
+		info.max_timestamp = rg.max_timestamp;
+		info.min_project = rg.min_project;
+		info.max_project = rg.max_project;
+		
+		for (std::size_t i(0); i < column_count; ++i)
+		{
+			auto const &col(rg.columns[i]);
+			std::uint64_t const offset(m_stream.tellp());
+			m_stream.write(reinterpret_cast <char const *>(col.validity.data()), col.validity.size());
+			switch (columns[i].type)
+			{
+				case ii::column_type::INT64:
+					write_values(col.integers);
+					break;
+				
+				case ii::column_type::FLOAT64:
+					write_values(col.reals);
+					break;
+				
+				case ii::column_type::STRING:
+					for (auto const val : col.offsets)
+						write_value(val);
+					m_stream.write(col.characters.data(), col.characters.size());
+					break;
+			}
+			
+			info.chunk_offsets.push_back(offset);
+			info.chunk_lengths.push_back(std::uint64_t(m_stream.tellp()) - offset);
+		}
+	}
+	
+	
+	void column_chunk_writer::finish()
+	{
+		std::uint64_t const footer_offset(m_stream.tellp());
+		
+		write_value(std::uint32_t(column_count));
+		for (auto const &spec : columns)
+		{
+			std::string_view const name(spec.name);
+			write_value(std::uint16_t(name.size()));
+			m_stream.write(name.data(), name.size());
+			write_value(libbio::to_underlying(spec.type));
+		}
+		
+		write_value(std::uint32_t(m_row_groups.size()));
+		for (auto const &info : m_row_groups)
+		{
+			write_value(info.row_count);
+			write_value(info.min_timestamp);
+			write_value(info.max_timestamp);
+			write_string(info.min_project);
+			write_string(info.max_project);
+			for (std::size_t i(0); i < column_count; ++i)
+			{
+				write_value(info.chunk_offsets[i]);
+				write_value(info.chunk_lengths[i]);
+			}
+		}
+		
+		write_value(std::uint64_t(m_stream.tellp()) - footer_offset);
+		m_stream.write(magic, sizeof(magic) - 1);
+		m_stream.close();
+	}
+
+
+#ifdef INDEX_IMAGES_HAVE_PARQUET
+	parquet_writer::parquet_writer(std::string const &path)
+	{
+		std::vector <std::shared_ptr <arrow::Field>> fields;
+		for (auto const &spec : columns)
+		{
+			switch (spec.type)
+			{
+				case ii::column_type::INT64:
+					fields.emplace_back(arrow::field(spec.name, arrow::int64()));
+					break;
+				
+				case ii::column_type::FLOAT64:
+					fields.emplace_back(arrow::field(spec.name, arrow::float64()));
+					break;
+				
+				case ii::column_type::STRING:
+					fields.emplace_back(arrow::field(spec.name, arrow::utf8()));
+					break;
+			}
+		}
+		
+		m_schema = arrow::schema(fields);
+		PARQUET_THROW_NOT_OK(arrow::io::FileOutputStream::Open(path, &m_stream));
+		PARQUET_THROW_NOT_OK(parquet::arrow::FileWriter::Open(*m_schema, arrow::default_memory_pool(), m_stream, parquet::default_writer_properties(), &m_writer));
+	}
+	
+	
+	void parquet_writer::write_row_group(row_group const &rg)
+	{
+		std::vector <std::shared_ptr <arrow::Array>> arrays;
+		for (std::size_t i(0); i < column_count; ++i)
+		{
+			auto const &col(rg.columns[i]);
+			std::shared_ptr <arrow::Array> array;
+			switch (columns[i].type)
+			{
+				case ii::column_type::INT64:
+				{
+					arrow::Int64Builder builder;
+					for (std::size_t j(0); j < rg.row_count; ++j)
+						PARQUET_THROW_NOT_OK(col.is_valid(j) ? builder.Append(col.integers[j]) : builder.AppendNull());
+					PARQUET_THROW_NOT_OK(builder.Finish(&array));
+					break;
+				}
+				
+				case ii::column_type::FLOAT64:
+				{
+					arrow::DoubleBuilder builder;
+					for (std::size_t j(0); j < rg.row_count; ++j)
+						PARQUET_THROW_NOT_OK(col.is_valid(j) ? builder.Append(col.reals[j]) : builder.AppendNull());
+					PARQUET_THROW_NOT_OK(builder.Finish(&array));
+					break;
+				}
+				
+				case ii::column_type::STRING:
+				{
+					arrow::StringBuilder builder;
+					for (std::size_t j(0); j < rg.row_count; ++j)
+					{
+						if (!col.is_valid(j))
+						{
+							PARQUET_THROW_NOT_OK(builder.AppendNull());
+							continue;
+						}
+						
+						auto const value(rg.string_value(i, j));
+						PARQUET_THROW_NOT_OK(builder.Append(value.data(), value.size()));
+					}
+					PARQUET_THROW_NOT_OK(builder.Finish(&array));
+					break;
+				}
+			}
+			
+			arrays.emplace_back(std::move(array));
+		}
+		
+		auto const table(arrow::Table::Make(m_schema, arrays, rg.row_count));
+		PARQUET_THROW_NOT_OK(m_writer->WriteTable(*table, rg.row_count));
+	}
+	
+	
+	void parquet_writer::finish()
+	{
+		PARQUET_THROW_NOT_OK(m_writer->Close());
+		PARQUET_THROW_NOT_OK(m_stream->Close());
+	}
+#endif
+	
+	
+	// Append the current row of stmt to rg. NULL values are stored as zeros or empty strings
+	// and marked in the validity bitmap.
+	void append_row(sqlite3_stmt *stmt, row_group &rg)
+	{
+		for (std::size_t i(0); i < column_count; ++i)
+		{
+			auto &col(rg.columns[i]);
+			col.push_validity(rg.row_count, SQLITE_NULL != sqlite3_column_type(stmt, i));
+			switch (columns[i].type)
+			{
+				case ii::column_type::INT64:
+					col.integers.push_back(sqlite3_column_int64(stmt, i));
+					break;
+				
+				case ii::column_type::FLOAT64:
+					col.reals.push_back(sqlite3_column_double(stmt, i));
+					break;
+				
+				case ii::column_type::STRING:
+				{
+					auto const *text(reinterpret_cast <char const *>(sqlite3_column_text(stmt, i)));
+					auto const length(sqlite3_column_bytes(stmt, i));
+					if (text)
+						col.characters.append(text, length);
+					col.offsets.push_back(col.characters.size());
+					break;
+				}
+			}
+		}
+		
+		++rg.row_count;
+		rg.update_statistics();
+	}
+}
+
+
+namespace index_images {
+	
+	bool can_export(export_format const format)
+	{
+		switch (format)
+		{
+			case export_format::COLUMN_CHUNKS:
+				return true;
+			
+			case export_format::PARQUET:
+#ifdef INDEX_IMAGES_HAVE_PARQUET
+				return true;
+#else
+				return false;
+#endif
+		}
+		
+		return false;
+	}
+	
+	
+	void export_metadata(sqlite::database &db, std::string const &path, export_format const format, std::uint32_t const row_group_size)
+	{
+		libbio_always_assert(can_export(format));
+		libbio_always_assert(0 < row_group_size);
+		
+		std::unique_ptr <export_writer> writer;
+		switch (format)
+		{
+			case export_format::COLUMN_CHUNKS:
+				writer.reset(new column_chunk_writer(path));
+				break;
+			
+			case export_format::PARQUET:
+#ifdef INDEX_IMAGES_HAVE_PARQUET
+				writer.reset(new parquet_writer(path));
+#endif
+				break;
+		}
+		
+		// Read the rows with the C API to be able to handle the columns generically.
+		std::string statement("SELECT ");
+		for (std::size_t i(0); i < column_count; ++i)
+		{
+			if (i)
+				statement += ", ";
+			statement += columns[i].name;
+		}
+		// Order by project first, so that the row groups span few projects and the project
+		// statistics can be used to skip them.
+		statement += " FROM image ORDER BY project, timestamp, id;";
+		
+		auto const connection(db.connection());
+		sqlite3_stmt *stmt_ptr{};
+		if (SQLITE_OK != sqlite3_prepare_v2(connection.get(), statement.c_str(), -1, &stmt_ptr, nullptr))
+			throw std::runtime_error(sqlite3_errmsg(connection.get()));
+		std::unique_ptr <sqlite3_stmt, decltype(&sqlite3_finalize)> stmt(stmt_ptr, &sqlite3_finalize);
+		
+		row_group rg;
+		std::size_t row_count(0);
+		while (true)
+		{
+			auto const res(sqlite3_step(stmt.get()));
+			if (SQLITE_DONE == res)
+				break;
+			if (SQLITE_ROW != res)
+				throw std::runtime_error(sqlite3_errmsg(connection.get()));
+			
+			append_row(stmt.get(), rg);
+			++row_count;
+			
+			if (row_group_size == rg.row_count)
+			{
+				writer->write_row_group(rg);
+				rg.clear();
+			}
+		}
+		
+		if (rg.row_count)
+			writer->write_row_group(rg);
+		writer->finish();
+		
+		std::cerr << "Exported " << row_count << " rows.\n";
+	}
+}
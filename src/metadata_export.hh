@@ -0,0 +1,59 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_METADATA_EXPORT_HH
+#define INDEX_IMAGES_METADATA_EXPORT_HH
+
+#include <cstdint>
+#include <sqlite_modern_cpp.h>
+#include <string>
+
+
+// Export the metadata columns (i.e. everything except the preview) to a columnar file.
+//
+// The built-in column chunk format is little-endian and laid out as follows:
+//
+//   "IIMCOL02"
+//   Column chunks of each row group, one after another.
+//     Each chunk begins with a validity bitmap of ceil(row_count / 8) bytes. The bit of each row,
+//     least significant first, is zero if the value is NULL.
+//     INT64 and FLOAT64 chunks then contain row_count values, zero for NULL.
+//     STRING chunks then contain row_count + 1 uint32 offsets followed by the UTF-8 data;
+//     NULL values are empty.
+//   Footer
+//     uint32 column_count
+//     column_count × (uint16 name_length, name, uint8 type)
+//     uint32 row_group_count
+//     row_group_count × (
+//       uint32 row_count,
+//       int64 min_timestamp, int64 max_timestamp,
+//       uint32 length, min_project, uint32 length, max_project,
+//       column_count × (uint64 offset, uint64 byte_length)
+//     )
+//   uint64 footer_length
+//   "IIMCOL02"
+//
+// The rows are ordered by project and timestamp, so the per-row-group minima and maxima can
+// be used to skip row groups. The statistics do not include NULL values.
+namespace index_images {
+	
+	enum class export_format : std::uint8_t
+	{
+		COLUMN_CHUNKS,
+		PARQUET			// Requires building with WITH_PARQUET=1.
+	};
+	
+	enum class column_type : std::uint8_t
+	{
+		INT64	= 1,
+		FLOAT64	= 2,
+		STRING	= 3
+	};
+	
+	bool can_export(export_format const format);
+	void export_metadata(sqlite::database &db, std::string const &path, export_format const format, std::uint32_t const row_group_size);
+}
+
+#endif
@@ -0,0 +1,164 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include "perceptual_hash.hh"
+
+
+namespace {
+	
+	namespace ii = index_images;
+	
+	enum {
+		DCT_INPUT_SIZE	= 32,
+		DCT_LOW_SIZE	= 8,
+		DHASH_WIDTH		= 9,
+		DHASH_HEIGHT	= 8
+	};
+	
+	typedef std::array <float, DCT_INPUT_SIZE * DCT_INPUT_SIZE>	dct_input_type;
+	typedef std::array <float, DHASH_WIDTH * DHASH_HEIGHT>		dhash_input_type;
+	
+	
+	// Basis functions of the low-frequency part of a 32-point DCT-II.
+	class dct_table
+	{
+	protected:
+		std::array <float, DCT_LOW_SIZE * DCT_INPUT_SIZE>	m_values{};
+		
+	public:
+		dct_table()
+		{
+			for (std::size_t k(0); k < DCT_LOW_SIZE; ++k)
+			{
+				for (std::size_t n(0); n < DCT_INPUT_SIZE; ++n)
+					m_values[k * DCT_INPUT_SIZE + n] = std::cos(M_PI / DCT_INPUT_SIZE * (n + 0.5) * k);
+			}
+		}
+		
+		float operator()(std::size_t const k, std::size_t const n) const { return m_values[k * DCT_INPUT_SIZE + n]; }
+	};
+	
+	
+	// Downscale to dst_width × dst_height grey values by averaging the source pixels in each cell.
+	template <std::size_t t_size>
+	void box_downscale(
+		std::uint8_t const *pixels,
+		std::size_t const width,
+		std::size_t const height,
+		std::size_t const colors,
+		std::size_t const dst_width,
+		std::size_t const dst_height,
+		std::array <float, t_size> &dst
+	)
+	{
+		std::array <std::uint32_t, t_size> counts{};
+		std::fill(dst.begin(), dst.end(), 0.0f);
+		
+		for (std::size_t y(0); y < height; ++y)
+		{
+			auto const dst_y(y * dst_height / height);
+			auto const *row(pixels + y * width * colors);
+			for (std::size_t x(0); x < width; ++x)
+			{
+				auto const dst_x(x * dst_width / width);
+				auto const *pixel(row + x * colors);
+				
+				// Rec. 601 luma.
+				float const value(3 == colors ? 0.299f * pixel[0] + 0.587f * pixel[1] + 0.114f * pixel[2] : pixel[0]);
+				auto const idx(dst_y * dst_width + dst_x);
+				dst[idx] += value;
+				++counts[idx];
+			}
+		}
+		
+		for (std::size_t i(0); i < dst_width * dst_height; ++i)
+			dst[i] /= counts[i];
+	}
+	
+	
+	std::uint64_t phash(dct_input_type const &input)
+	{
+		static dct_table const table;
+		
+		// The DCT is separable; only the first eight coefficients are needed in each direction.
+		std::array <float, DCT_INPUT_SIZE * DCT_LOW_SIZE> rows{};
+		for (std::size_t y(0); y < DCT_INPUT_SIZE; ++y)
+		{
+			for (std::size_t k(0); k < DCT_LOW_SIZE; ++k)
+			{
+				float sum(0);
+				for (std::size_t x(0); x < DCT_INPUT_SIZE; ++x)
+					sum += table(k, x) * input[y * DCT_INPUT_SIZE + x];
+				rows[y * DCT_LOW_SIZE + k] = sum;
+			}
+		}
+		
+		std::array <float, DCT_LOW_SIZE * DCT_LOW_SIZE> coefficients{};
+		for (std::size_t l(0); l < DCT_LOW_SIZE; ++l)
+		{
+			for (std::size_t k(0); k < DCT_LOW_SIZE; ++k)
+			{
+				float sum(0);
+				for (std::size_t y(0); y < DCT_INPUT_SIZE; ++y)
+					sum += table(l, y) * rows[y * DCT_LOW_SIZE + k];
+				coefficients[l * DCT_LOW_SIZE + k] = sum;
+			}
+		}
+		
+		auto sorted(coefficients);
+		auto const mid(sorted.begin() + sorted.size() / 2);
+		std::nth_element(sorted.begin(), mid, sorted.end());
+		auto const median(*mid);
+		
+		std::uint64_t retval(0);
+		for (std::size_t i(0); i < coefficients.size(); ++i)
+		{
+			if (median < coefficients[i])
+				retval |= std::uint64_t(1) << i;
+		}
+		return retval;
+	}
+	
+	
+	std::uint64_t dhash(dhash_input_type const &input)
+	{
+		std::uint64_t retval(0);
+		std::size_t bit(0);
+		for (std::size_t y(0); y < DHASH_HEIGHT; ++y)
+		{
+			for (std::size_t x(0); x + 1 < DHASH_WIDTH; ++x)
+			{
+				if (input[y * DHASH_WIDTH + x] < input[y * DHASH_WIDTH + x + 1])
+					retval |= std::uint64_t(1) << bit;
+				++bit;
+			}
+		}
+		return retval;
+	}
+}
+
+
+namespace index_images {
+	
+	perceptual_hashes compute_perceptual_hashes(std::uint8_t const *pixels, std::size_t const width, std::size_t const height, std::size_t const colors)
+	{
+		perceptual_hashes retval;
+		if (width < DCT_INPUT_SIZE || height < DCT_INPUT_SIZE)
+			return retval;
+		
+		dct_input_type dct_input;
+		dhash_input_type dhash_input;
+		box_downscale(pixels, width, height, colors, DCT_INPUT_SIZE, DCT_INPUT_SIZE, dct_input);
+		box_downscale(pixels, width, height, colors, DHASH_WIDTH, DHASH_HEIGHT, dhash_input);
+		
+		retval.phash = phash(dct_input);
+		retval.dhash = dhash(dhash_input);
+		retval.is_valid = true;
+		return retval;
+	}
+}
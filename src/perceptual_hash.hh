@@ -0,0 +1,34 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_PERCEPTUAL_HASH_HH
+#define INDEX_IMAGES_PERCEPTUAL_HASH_HH
+
+#include <cstddef>
+#include <cstdint>
+
+
+namespace index_images {
+	
+	struct perceptual_hashes
+	{
+		std::uint64_t	phash{};		// Signs of the low-frequency DCT coefficients relative to their median.
+		std::uint64_t	dhash{};		// Horizontal gradients.
+		bool			is_valid{};
+	};
+	
+	
+	// The similarity index splits the pHash into chunks. By the pigeonhole principle, an image
+	// within Hamming distance d has at least one chunk within distance d / PHASH_CHUNK_COUNT.
+	enum { PHASH_CHUNK_COUNT = 4, PHASH_CHUNK_BITS = 16 };
+	
+	inline std::uint16_t phash_chunk(std::uint64_t const hash, std::size_t const idx) { return hash >> (idx * PHASH_CHUNK_BITS); }
+	inline std::uint8_t hamming_distance(std::uint64_t const lhs, std::uint64_t const rhs) { return __builtin_popcountll(lhs ^ rhs); }
+	
+	// Compute the hashes from an interleaved 8-bit image with one or three components.
+	perceptual_hashes compute_perceptual_hashes(std::uint8_t const *pixels, std::size_t const width, std::size_t const height, std::size_t const colors);
+}
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include "preview_cache.hh"
+
+
+namespace index_images {
+	
+	auto preview_cache::find(std::uint64_t const key) -> value_type
+	{
+		std::lock_guard lock(m_mutex);
+		auto const it(m_entries_by_key.find(key));
+		if (m_entries_by_key.end() == it)
+			return value_type();
+		
+		// Move to the front.
+		m_entries.splice(m_entries.begin(), m_entries, it->second);
+		return it->second->second;
+	}
+	
+	
+	void preview_cache::insert(std::uint64_t const key, value_type value, std::uint64_t const generation)
+	{
+		auto const value_size(value->data.size());
+		if (m_max_size < value_size)
+			return;
+		
+		std::lock_guard lock(m_mutex);
+		if (generation != m_generation)
+			return;
+		
+		// Another thread may have added the same value.
+		if (m_entries_by_key.end() != m_entries_by_key.find(key))
+			return;
+		
+		// Evict the least recently used values.
+		while (m_max_size - m_size < value_size)
+		{
+			auto const &last(m_entries.back());
+			m_size -= last.second->data.size();
+			m_entries_by_key.erase(last.first);
+			m_entries.pop_back();
+		}
+		
+		m_entries.emplace_front(key, std::move(value));
+		m_entries_by_key.emplace(key, m_entries.begin());
+		m_size += value_size;
+	}
+	
+	
+	std::uint64_t preview_cache::generation()
+	{
+		std::lock_guard lock(m_mutex);
+		return m_generation;
+	}
+	
+	
+	void preview_cache::clear()
+	{
+		std::lock_guard lock(m_mutex);
+		m_entries_by_key.clear();
+		m_entries.clear();
+		m_size = 0;
+		++m_generation;
+	}
+}
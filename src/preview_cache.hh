@@ -0,0 +1,64 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_PREVIEW_CACHE_HH
+#define INDEX_IMAGES_PREVIEW_CACHE_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+
+namespace index_images {
+	
+	// An encoded image and a digest of its contents.
+	struct cached_preview
+	{
+		std::vector <char>	data;
+		std::uint64_t		digest{};
+	};
+	
+	
+	// Thread-safe LRU cache of encoded images limited by the total size of the values.
+	// The values are shared, so they may be used after they have been evicted.
+	class preview_cache
+	{
+	public:
+		typedef std::shared_ptr <cached_preview const>		value_type;
+		
+	protected:
+		typedef std::pair <std::uint64_t, value_type>		entry_type;
+		typedef std::list <entry_type>						entry_list;		// Most recently used first.
+		
+	protected:
+		std::mutex											m_mutex;
+		entry_list											m_entries;
+		std::unordered_map <std::uint64_t, entry_list::iterator>	m_entries_by_key;
+		std::size_t											m_size{};
+		std::size_t											m_max_size{};
+		std::uint64_t										m_generation{};
+		
+	public:
+		explicit preview_cache(std::size_t const max_size):
+			m_max_size(max_size)
+		{
+		}
+		
+		// Returns an empty pointer if the key was not found.
+		value_type find(std::uint64_t const key);
+		
+		// The value is not inserted if the cache has been cleared after generation() was called,
+		// since it may have been read before the change that caused the clearing.
+		void insert(std::uint64_t const key, value_type value, std::uint64_t const generation);
+		std::uint64_t generation();
+		void clear();
+	};
+}
+
+#endif
@@ -0,0 +1,577 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cctype>
+#include <charconv>
+#include <csignal>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <netinet/in.h>
+#include <sqlite3.h>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include "preview_cache.hh"
+#include "preview_server.hh"
+
+
+namespace {
+	
+	namespace ii = index_images;
+	
+	
+	enum class blob_kind : std::uint8_t
+	{
+		PREVIEW		= 0,
+		THUMBNAIL	= 1
+	};
+	
+	
+	enum {
+		MAX_HEADER_SIZE			= 16384,
+		IDLE_TIMEOUT_SECONDS	= 60
+	};
+	
+	
+	std::uint64_t cache_key(std::int64_t const id, blob_kind const kind)
+	{
+		return (std::uint64_t(id) << 1) | std::uint64_t(kind);
+	}
+	
+	
+	// FNV-1a.
+	std::uint64_t digest(std::vector <char> const &data)
+	{
+		std::uint64_t retval(0xcbf29ce484222325);
+		for (auto const cc : data)
+		{
+			retval ^= static_cast <unsigned char>(cc);
+			retval *= 0x100000001b3;
+		}
+		return retval;
+	}
+	
+	
+	std::string error_message(char const *what)
+	{
+		return std::string(what) + ": " + std::strerror(errno);
+	}
+	
+	
+	bool write_all(int const fd, char const *data, std::size_t size)
+	{
+		while (size)
+		{
+			auto const res(write(fd, data, size));
+			if (res < 0)
+			{
+				if (EINTR == errno)
+					continue;
+				return false;
+			}
+			
+			data += res;
+			size -= res;
+		}
+		
+		return true;
+	}
+	
+	
+	// Read-only connection for one client. The blob handles are not kept open between requests,
+	// since they would keep a read transaction open and prevent the indexer from committing.
+	class blob_reader
+	{
+	protected:
+		sqlite3	*m_db{};
+		
+	public:
+		explicit blob_reader(std::string const &path)
+		{
+			if (SQLITE_OK != sqlite3_open_v2(path.c_str(), &m_db, SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX, nullptr))
+			{
+				std::string const message(sqlite3_errmsg(m_db));
+				sqlite3_close(m_db);
+				throw std::runtime_error(message);
+			}
+			
+			sqlite3_busy_timeout(m_db, 5000);
+		}
+		
+		~blob_reader() { sqlite3_close(m_db); }
+		
+		blob_reader(blob_reader const &) = delete;
+		blob_reader &operator=(blob_reader const &) = delete;
+		
+		// Returns false if the row does not exist or the value is NULL.
+		bool read(std::int64_t const id, blob_kind const kind, std::vector <char> &dst);
+		
+		// Changes when another connection has committed to the database.
+		std::int64_t data_version();
+	};
+	
+	
+	bool blob_reader::read(std::int64_t const id, blob_kind const kind, std::vector <char> &dst)
+	{
+		auto const *column(blob_kind::THUMBNAIL == kind ? "thumbnail" : "preview");
+		sqlite3_blob *blob{};
+		if (SQLITE_OK != sqlite3_blob_open(m_db, "main", "image_record", column, id, 0, &blob))
+			return false;
+		
+		auto const size(sqlite3_blob_bytes(blob));
+		dst.resize(size);
+		auto const st(sqlite3_blob_read(blob, dst.data(), size, 0));
+		sqlite3_blob_close(blob);
+		return SQLITE_OK == st;
+	}
+	
+	
+	std::int64_t blob_reader::data_version()
+	{
+		sqlite3_stmt *stmt{};
+		if (SQLITE_OK != sqlite3_prepare_v2(m_db, "PRAGMA data_version", -1, &stmt, nullptr))
+			throw std::runtime_error(sqlite3_errmsg(m_db));
+		
+		std::int64_t retval(-1);
+		if (SQLITE_ROW == sqlite3_step(stmt))
+			retval = sqlite3_column_int64(stmt, 0);
+		sqlite3_finalize(stmt);
+		return retval;
+	}
+	
+	
+	// Clears the cache when the indexer has committed, since the previews may have been replaced.
+	// The data version is relative to the connection, so a single one is used for all clients.
+	class cache_invalidator
+	{
+	protected:
+		std::mutex			m_mutex;
+		blob_reader			m_reader;
+		ii::preview_cache	*m_cache{};
+		std::int64_t		m_data_version{};
+		
+	public:
+		cache_invalidator(std::string const &path, ii::preview_cache &cache):
+			m_reader(path),
+			m_cache(&cache),
+			m_data_version(m_reader.data_version())
+		{
+		}
+		
+		void check();
+	};
+	
+	
+	void cache_invalidator::check()
+	{
+		std::lock_guard lock(m_mutex);
+		auto const data_version(m_reader.data_version());
+		if (data_version != m_data_version)
+		{
+			m_data_version = data_version;
+			m_cache->clear();
+		}
+	}
+	
+	
+	struct http_request
+	{
+		std::string_view	method;
+		std::string_view	target;
+		std::string_view	if_none_match;
+		bool				keep_alive{};
+		bool				has_body{};
+	};
+	
+	
+	bool equals_ignoring_case(std::string_view const lhs, std::string_view const rhs)
+	{
+		return lhs.size() == rhs.size() && std::equal(lhs.begin(), lhs.end(), rhs.begin(), [](char const a, char const b){
+			return std::tolower(static_cast <unsigned char>(a)) == std::tolower(static_cast <unsigned char>(b));
+		});
+	}
+	
+	
+	std::string_view trim(std::string_view sv)
+	{
+		while (!sv.empty() && (' ' == sv.front() || '\t' == sv.front()))
+			sv.remove_prefix(1);
+		while (!sv.empty() && (' ' == sv.back() || '\t' == sv.back()))
+			sv.remove_suffix(1);
+		return sv;
+	}
+	
+	
+	// Parse the request line and the relevant headers. The header block excludes the final empty line.
+	bool parse_request(std::string_view header_block, http_request &req)
+	{
+		auto const line_end(header_block.find("\r\n"));
+		auto const request_line(header_block.substr(0, line_end));
+		header_block.remove_prefix(std::string_view::npos == line_end ? header_block.size() : line_end + 2);
+		
+		auto const first_space(request_line.find(' '));
+		auto const second_space(request_line.find(' ', first_space + 1));
+		if (std::string_view::npos == first_space || std::string_view::npos == second_space)
+			return false;
+		
+		req.method = request_line.substr(0, first_space);
+		req.target = request_line.substr(1 + first_space, second_space - first_space - 1);
+		auto const version(request_line.substr(1 + second_space));
+		req.keep_alive = ("HTTP/1.1" == version);
+		
+		while (!header_block.empty())
+		{
+			auto const end(header_block.find("\r\n"));
+			auto const line(header_block.substr(0, end));
+			header_block.remove_prefix(std::string_view::npos == end ? header_block.size() : end + 2);
+			
+			auto const colon(line.find(':'));
+			if (std::string_view::npos == colon)
+				return false;
+			
+			auto const name(line.substr(0, colon));
+			auto const value(trim(line.substr(1 + colon)));
+			if (equals_ignoring_case(name, "Connection"))
+			{
+				if (equals_ignoring_case(value, "close"))
+					req.keep_alive = false;
+				else if (equals_ignoring_case(value, "keep-alive"))
+					req.keep_alive = true;
+			}
+			else if (equals_ignoring_case(name, "If-None-Match"))
+			{
+				req.if_none_match = value;
+			}
+			else if (equals_ignoring_case(name, "Content-Length") || equals_ignoring_case(name, "Transfer-Encoding"))
+			{
+				req.has_body = ("0" != value);
+			}
+		}
+		
+		return true;
+	}
+	
+	
+	// Check whether the value of If-None-Match lists the given entity tag.
+	bool etag_matches(std::string_view if_none_match, std::string const &etag)
+	{
+		if ("*" == if_none_match)
+			return true;
+		
+		while (!if_none_match.empty())
+		{
+			auto const comma(if_none_match.find(','));
+			auto tag(trim(if_none_match.substr(0, comma)));
+			if (0 == tag.compare(0, 2, "W/"))
+				tag.remove_prefix(2);
+			if (tag == etag)
+				return true;
+			
+			if (std::string_view::npos == comma)
+				break;
+			if_none_match.remove_prefix(1 + comma);
+		}
+		
+		return false;
+	}
+	
+	
+	class connection_handler
+	{
+	protected:
+		ii::preview_cache	*m_cache{};
+		cache_invalidator	*m_invalidator{};
+		blob_reader			*m_reader{};
+		std::string			m_input;
+		std::string			m_header;
+		int					m_fd{-1};
+		
+	public:
+		connection_handler(int const fd, blob_reader &reader, ii::preview_cache &cache, cache_invalidator &invalidator):
+			m_cache(&cache),
+			m_invalidator(&invalidator),
+			m_reader(&reader),
+			m_fd(fd)
+		{
+		}
+		
+		// Handle requests until the client closes the connection or an error occurs.
+		void run();
+		
+	protected:
+		bool handle_request(http_request const &req);
+		bool send_response(char const *status, http_request const &req, std::string const *etag, ii::preview_cache::value_type const &body);
+		ii::preview_cache::value_type find_blob(std::int64_t const id, blob_kind const kind);
+	};
+	
+	
+	void connection_handler::run()
+	{
+		char buffer[4096];
+		while (true)
+		{
+			// Read until the end of the header block.
+			std::size_t header_end(0);
+			while (std::string::npos == (header_end = m_input.find("\r\n\r\n")))
+			{
+				if (MAX_HEADER_SIZE < m_input.size())
+					return;
+				
+				auto const res(read(m_fd, buffer, sizeof(buffer)));
+				if (0 == res)
+					return;
+				if (res < 0)
+				{
+					if (EINTR == errno)
+						continue;
+					return; // Including the idle timeout.
+				}
+				
+				m_input.append(buffer, res);
+			}
+			
+			http_request req;
+			if (!parse_request(std::string_view(m_input).substr(0, header_end), req))
+			{
+				req.keep_alive = false;
+				send_response("400 Bad Request", req, nullptr, nullptr);
+				return;
+			}
+			
+			// Request bodies are not expected, so the connection is not reused if one was sent.
+			if (req.has_body)
+				req.keep_alive = false;
+			
+			if (!handle_request(req) || !req.keep_alive)
+				return;
+			
+			m_input.erase(0, header_end + 4);
+		}
+	}
+	
+	
+	auto connection_handler::find_blob(std::int64_t const id, blob_kind const kind) -> ii::preview_cache::value_type
+	{
+		auto const key(cache_key(id, kind));
+		auto const generation(m_cache->generation());
+		if (auto value(m_cache->find(key)); value)
+			return value;
+		
+		auto blob(std::make_shared <ii::cached_preview>());
+		if (!m_reader->read(id, kind, blob->data))
+			return nullptr;
+		
+		blob->digest = digest(blob->data);
+		m_cache->insert(key, blob, generation);
+		return blob;
+	}
+	
+	
+	bool connection_handler::handle_request(http_request const &req)
+	{
+		if (req.method != "GET" && req.method != "HEAD")
+			return send_response("405 Method Not Allowed", req, nullptr, nullptr);
+		
+		// Route.
+		blob_kind kind{};
+		std::string_view id_str;
+		std::string_view const preview_prefix("/preview/");
+		std::string_view const thumbnail_prefix("/thumb/");
+		if (0 == req.target.compare(0, preview_prefix.size(), preview_prefix))
+		{
+			kind = blob_kind::PREVIEW;
+			id_str = req.target.substr(preview_prefix.size());
+		}
+		else if (0 == req.target.compare(0, thumbnail_prefix.size(), thumbnail_prefix))
+		{
+			kind = blob_kind::THUMBNAIL;
+			id_str = req.target.substr(thumbnail_prefix.size());
+		}
+		else
+		{
+			return send_response("404 Not Found", req, nullptr, nullptr);
+		}
+		
+		std::int64_t id(0);
+		auto const res(std::from_chars(id_str.data(), id_str.data() + id_str.size(), id));
+		if (std::errc() != res.ec || id_str.data() + id_str.size() != res.ptr || id <= 0)
+			return send_response("404 Not Found", req, nullptr, nullptr);
+		
+		m_invalidator->check();
+		
+		// Images indexed before the thumbnails were added only have the preview.
+		auto blob(find_blob(id, kind));
+		if (!blob && blob_kind::THUMBNAIL == kind)
+		{
+			kind = blob_kind::PREVIEW;
+			blob = find_blob(id, kind);
+		}
+		
+		if (!blob)
+			return send_response("404 Not Found", req, nullptr, nullptr);
+		
+		// The previews are replaced when an image is indexed again, so the contents determine the tag.
+		char digest_buffer[16];
+		auto const digest_res(std::to_chars(digest_buffer, digest_buffer + sizeof(digest_buffer), blob->digest, 16));
+		std::string const etag("\"" + std::string(blob_kind::THUMBNAIL == kind ? "t" : "p") + std::to_string(id) + "-" + std::string(digest_buffer, digest_res.ptr) + "\"");
+		if (!req.if_none_match.empty() && etag_matches(req.if_none_match, etag))
+			return send_response("304 Not Modified", req, &etag, nullptr);
+		
+		return send_response("200 OK", req, &etag, blob);
+	}
+	
+	
+	// Send the status line, the headers and the body if given. The body is omitted in responses to HEAD.
+	bool connection_handler::send_response(char const *status, http_request const &req, std::string const *etag, ii::preview_cache::value_type const &body)
+	{
+		m_header.clear();
+		m_header += "HTTP/1.1 ";
+		m_header += status;
+		m_header += "\r\n";
+		
+		if (etag)
+		{
+			m_header += "Content-Type: image/jpeg\r\n";
+			m_header += "Cache-Control: private, max-age=86400\r\n";
+			m_header += "ETag: ";
+			m_header += *etag;
+			m_header += "\r\n";
+		}
+		
+		if (body)
+			m_header += "Content-Length: " + std::to_string(body->data.size()) + "\r\n";
+		else if (0 != std::strncmp(status, "304", 3))
+			m_header += "Content-Length: 0\r\n";
+		
+		if (0 == std::strncmp(status, "405", 3))
+			m_header += "Allow: GET, HEAD\r\n";
+		
+		m_header += (req.keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n");
+		
+		if (!write_all(m_fd, m_header.data(), m_header.size()))
+			return false;
+		
+		if (body && req.method != "HEAD" && !write_all(m_fd, body->data.data(), body->data.size()))
+			return false;
+		
+		return true;
+	}
+	
+	
+	int listen_unix(std::string const &path)
+	{
+		sockaddr_un addr{};
+		if (sizeof(addr.sun_path) <= path.size())
+			throw std::runtime_error("The socket path is too long.");
+		
+		// Remove a stale socket but nothing else.
+		struct stat sb{};
+		if (0 == lstat(path.c_str(), &sb) && S_ISSOCK(sb.st_mode))
+			unlink(path.c_str());
+		
+		auto const fd(socket(AF_UNIX, SOCK_STREAM, 0));
+		if (-1 == fd)
+			throw std::runtime_error(error_message("Unable to create a socket"));
+		
+		addr.sun_family = AF_UNIX;
+		std::copy(path.begin(), path.end(), addr.sun_path);
+		if (-1 == bind(fd, reinterpret_cast <sockaddr const *>(&addr), sizeof(addr)))
+		{
+			auto const message(error_message("Unable to bind the socket"));
+			close(fd);
+			throw std::runtime_error(message);
+		}
+		
+		return fd;
+	}
+	
+	
+	int listen_loopback(std::uint16_t const port)
+	{
+		auto const fd(socket(AF_INET, SOCK_STREAM, 0));
+		if (-1 == fd)
+			throw std::runtime_error(error_message("Unable to create a socket"));
+		
+		int const reuse(1);
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		
+		sockaddr_in addr{};
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (-1 == bind(fd, reinterpret_cast <sockaddr const *>(&addr), sizeof(addr)))
+		{
+			auto const message(error_message("Unable to bind the socket"));
+			close(fd);
+			throw std::runtime_error(message);
+		}
+		
+		return fd;
+	}
+}
+
+
+namespace index_images {
+	
+	void serve_previews(serve_arguments const &args)
+	{
+		// Write errors are handled where they occur.
+		std::signal(SIGPIPE, SIG_IGN);
+		
+		// Also checks that the database can be opened before accepting connections.
+		preview_cache cache(args.cache_size);
+		cache_invalidator invalidator(args.database_path, cache);
+		
+		auto const fd(args.socket_path.empty() ? listen_loopback(args.port) : listen_unix(args.socket_path));
+		if (-1 == listen(fd, 64))
+			throw std::runtime_error(error_message("Unable to listen"));
+		
+		if (args.socket_path.empty())
+			std::cerr << "Listening on http://127.0.0.1:" << args.port << "/\n";
+		else
+			std::cerr << "Listening on " << args.socket_path << '\n';
+		
+		while (true)
+		{
+			auto const client_fd(accept(fd, nullptr, nullptr));
+			if (-1 == client_fd)
+			{
+				if (EINTR != errno && ECONNABORTED != errno)
+					std::cerr << "Unable to accept a connection: " << std::strerror(errno) << '\n';
+				continue;
+			}
+			
+			// Close idle connections.
+			timeval timeout{};
+			timeout.tv_sec = IDLE_TIMEOUT_SECONDS;
+			setsockopt(client_fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+			
+			std::thread([client_fd, &args, &cache, &invalidator](){
+				try
+				{
+					blob_reader reader(args.database_path);
+					connection_handler handler(client_fd, reader, cache, invalidator);
+					handler.run();
+				}
+				catch (std::exception const &exc)
+				{
+					std::cerr << "Unable to handle a connection: " << exc.what() << '\n';
+				}
+				
+				close(client_fd);
+			}).detach();
+		}
+	}
+}
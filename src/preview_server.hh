@@ -0,0 +1,33 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_PREVIEW_SERVER_HH
+#define INDEX_IMAGES_PREVIEW_SERVER_HH
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+
+namespace index_images {
+	
+	struct serve_arguments
+	{
+		std::string		database_path;
+		std::string		socket_path;		// Listen on a Unix domain socket if not empty.
+		std::size_t		cache_size{};		// In bytes.
+		std::uint16_t	port{};				// Listen on the loopback interface otherwise.
+	};
+	
+	
+	// Serve the previews and the thumbnails over HTTP/1.1 as GET /preview/<id> and GET /thumb/<id>.
+	// The blobs are read with SQLite’s incremental blob I/O and the recently used ones are cached.
+	// Each connection is handled in its own thread and may be kept alive. The ETag header is set,
+	// so conditional requests with If-None-Match are answered with 304. Does not return unless
+	// the socket cannot be set up, in which case std::runtime_error is thrown.
+	void serve_previews(serve_arguments const &args);
+}
+
+#endif
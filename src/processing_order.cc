@@ -0,0 +1,118 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <cstddef>
+#include <fcntl.h>
+#include <type_traits>
+#include <unistd.h>
+#include "processing_order.hh"
+
+#ifdef __linux__
+#	include <linux/fiemap.h>
+#	include <linux/fs.h>
+#	include <sys/ioctl.h>
+#endif
+
+
+namespace {
+	
+	namespace ii = index_images;
+	
+	
+	// Determine the physical offset of the beginning of the file. Returns false if it is not available.
+	bool first_extent_offset(std::string const &path, std::uint64_t &offset)
+	{
+#ifdef __linux__
+		auto const fd(open(path.c_str(), O_RDONLY));
+		if (-1 == fd)
+			return false;
+		
+		// Space for one extent.
+		alignas(fiemap) std::byte buffer[sizeof(fiemap) + sizeof(fiemap_extent)]{};
+		auto &map(*reinterpret_cast <fiemap *>(buffer));
+		map.fm_start = 0;
+		map.fm_length = FIEMAP_MAX_OFFSET;
+		map.fm_extent_count = 1;
+		
+		auto const res(ioctl(fd, FS_IOC_FIEMAP, &map));
+		close(fd);
+		
+		if (-1 == res || 0 == map.fm_mapped_extents)
+			return false;
+		
+		offset = map.fm_extents[0].fe_physical;
+		return true;
+#else
+		return false;
+#endif
+	}
+	
+	
+	// Sort by keys that are costly to determine.
+	template <typename t_key_fn>
+	void sort_by_key(std::vector <ii::scheduled_image> &images, t_key_fn &&key_fn)
+	{
+		typedef std::pair <std::invoke_result_t <t_key_fn, ii::scheduled_image const &>, std::size_t> key_type;
+		
+		// Determine the keys only once.
+		std::vector <key_type> keys;
+		keys.reserve(images.size());
+		for (std::size_t i(0); i < images.size(); ++i)
+			keys.emplace_back(key_fn(images[i]), i);
+		
+		std::sort(keys.begin(), keys.end());
+		
+		std::vector <ii::scheduled_image> sorted;
+		sorted.reserve(images.size());
+		for (auto const &key : keys)
+			sorted.emplace_back(std::move(images[key.second]));
+		
+		images = std::move(sorted);
+	}
+}
+
+
+namespace index_images {
+	
+	void sort_images(std::vector <scheduled_image> &images, processing_order const order)
+	{
+		switch (order)
+		{
+			case processing_order::TRAVERSAL:
+				break;
+			
+			case processing_order::SIZE:
+				std::stable_sort(images.begin(), images.end(), [](auto const &lhs, auto const &rhs){
+					return lhs.size > rhs.size;
+				});
+				break;
+			
+			case processing_order::NEWEST:
+				std::stable_sort(images.begin(), images.end(), [](auto const &lhs, auto const &rhs){
+					return lhs.mtime > rhs.mtime;
+				});
+				break;
+			
+			case processing_order::INODE:
+				std::stable_sort(images.begin(), images.end(), [](auto const &lhs, auto const &rhs){
+					return lhs.inode < rhs.inode;
+				});
+				break;
+			
+			case processing_order::EXTENT:
+			{
+				// The files without extent information are placed after the others in inode order.
+				sort_by_key(images, [](scheduled_image const &image){
+					std::uint64_t offset(0);
+					if (first_extent_offset(image.path, offset))
+						return std::make_pair(false, offset);
+					return std::make_pair(true, image.inode);
+				});
+				break;
+			}
+		}
+	}
+}
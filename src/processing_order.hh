@@ -0,0 +1,29 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_PROCESSING_ORDER_HH
+#define INDEX_IMAGES_PROCESSING_ORDER_HH
+
+#include <cstdint>
+#include <vector>
+#include "work_stealing_queue.hh"
+
+
+namespace index_images {
+	
+	enum class processing_order : std::uint8_t
+	{
+		SIZE,		// Largest first, so that the run does not end with a long tail.
+		TRAVERSAL,	// As discovered.
+		INODE,		// Approximates the on-disk order on many file systems.
+		EXTENT,		// By the physical offset of the first extent; falls back to INODE where not available.
+		NEWEST		// Most recently modified first.
+	};
+	
+	// Sort a batch of discovered images. The sort is stable, so ties retain the traversal order.
+	void sort_images(std::vector <scheduled_image> &images, processing_order const order);
+}
+
+#endif
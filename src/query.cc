@@ -0,0 +1,546 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <tuple>
+#include <variant>
+#include <vector>
+#include "perceptual_hash.hh"
+#include "query.hh"
+#include "schema.hh"
+
+
+namespace {
+	
+	namespace ii = index_images;
+	
+	typedef std::variant <std::string, std::int64_t, double> parameter_type;
+	
+	
+	// Write the rows either as TSV or as JSON objects, one per line.
+	class row_writer
+	{
+	protected:
+		std::ostream		*m_os{};
+		ii::output_format	m_format{};
+		bool				m_is_first{};
+		
+	public:
+		row_writer(std::ostream &os, ii::output_format const format):
+			m_os(&os),
+			m_format(format)
+		{
+		}
+		
+		void write_header(std::initializer_list <char const *> const names);
+		void begin_row();
+		void end_row();
+		
+		void write_field(char const *name, std::string const &value);
+		void write_field(char const *name, std::int64_t const value) { write_field_prefix(name); *m_os << value; }
+		void write_field(char const *name, double const value) { write_field_prefix(name); *m_os << value; }
+		void write_field(char const *name, std::unique_ptr <double> const &value) { write_nullable_field(name, value); }
+		void write_field(char const *name, std::unique_ptr <std::int64_t> const &value) { write_nullable_field(name, value); }
+		
+	protected:
+		template <typename t_value>
+		void write_nullable_field(char const *name, std::unique_ptr <t_value> const &value);
+		
+		void write_field_prefix(char const *name);
+		void write_escaped_tsv(std::string const &value);
+		void write_escaped_json(std::string const &value);
+	};
+	
+	
+	void row_writer::write_header(std::initializer_list <char const *> const names)
+	{
+		if (ii::output_format::TSV != m_format)
+			return;
+		
+		bool is_first(true);
+		for (auto const *name : names)
+		{
+			if (!is_first)
+				*m_os << '\t';
+			*m_os << name;
+			is_first = false;
+		}
+		*m_os << '\n';
+	}
+	
+	
+	void row_writer::begin_row()
+	{
+		m_is_first = true;
+		if (ii::output_format::JSON == m_format)
+			*m_os << '{';
+	}
+	
+	
+	void row_writer::end_row()
+	{
+		if (ii::output_format::JSON == m_format)
+			*m_os << '}';
+		*m_os << '\n';
+	}
+	
+	
+	void row_writer::write_field_prefix(char const *name)
+	{
+		switch (m_format)
+		{
+			case ii::output_format::TSV:
+				if (!m_is_first)
+					*m_os << '\t';
+				break;
+			
+			case ii::output_format::JSON:
+				if (!m_is_first)
+					*m_os << ',';
+				*m_os << '"' << name << "\":";
+				break;
+		}
+		
+		m_is_first = false;
+	}
+	
+	
+	void row_writer::write_field(char const *name, std::string const &value)
+	{
+		write_field_prefix(name);
+		switch (m_format)
+		{
+			case ii::output_format::TSV:
+				write_escaped_tsv(value);
+				break;
+			
+			case ii::output_format::JSON:
+				write_escaped_json(value);
+				break;
+		}
+	}
+	
+	
+	// NULL is written as an empty field or null.
+	template <typename t_value>
+	void row_writer::write_nullable_field(char const *name, std::unique_ptr <t_value> const &value)
+	{
+		if (value)
+		{
+			write_field(name, *value);
+			return;
+		}
+		
+		write_field_prefix(name);
+		if (ii::output_format::JSON == m_format)
+			*m_os << "null";
+	}
+	
+	
+	void row_writer::write_escaped_tsv(std::string const &value)
+	{
+		for (auto const c : value)
+		{
+			switch (c)
+			{
+				case '\t':	*m_os << "\\t";		break;
+				case '\n':	*m_os << "\\n";		break;
+				case '\r':	*m_os << "\\r";		break;
+				case '\\':	*m_os << "\\\\";	break;
+				default:	*m_os << c;			break;
+			}
+		}
+	}
+	
+	
+	void row_writer::write_escaped_json(std::string const &value)
+	{
+		*m_os << '"';
+		for (auto const c : value)
+		{
+			switch (c)
+			{
+				case '"':	*m_os << "\\\"";	break;
+				case '\\':	*m_os << "\\\\";	break;
+				case '\b':	*m_os << "\\b";		break;
+				case '\f':	*m_os << "\\f";		break;
+				case '\n':	*m_os << "\\n";		break;
+				case '\r':	*m_os << "\\r";		break;
+				case '\t':	*m_os << "\\t";		break;
+				default:
+				{
+					if (0 <= c && c < 0x20)
+					{
+						char buffer[7]{};
+						std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+						*m_os << buffer;
+					}
+					else
+					{
+						*m_os << c;
+					}
+					break;
+				}
+			}
+		}
+		*m_os << '"';
+	}
+	
+	
+	// Convert free-form search text to an FTS5 query. Each whitespace-separated word is quoted,
+	// so that punctuation (as in “12-40”) is handled by the tokenizer instead of the query syntax,
+	// and matched as a prefix, so that the last token may be partial (“40” in “12-40mm”).
+	// All of the words need to match.
+	std::string fts_query(std::string const &text)
+	{
+		std::string retval;
+		bool in_word(false);
+		for (auto const c : text)
+		{
+			if (std::isspace(static_cast <unsigned char>(c)))
+			{
+				if (in_word)
+				{
+					retval += "\"* ";
+					in_word = false;
+				}
+				continue;
+			}
+			
+			if (!in_word)
+			{
+				retval += '"';
+				in_word = true;
+			}
+			
+			if ('"' == c)
+				retval += '"';
+			retval += c;
+		}
+		
+		if (in_word)
+			retval += "\"*";
+		
+		return retval;
+	}
+	
+	
+	// Append a condition and its parameter to the WHERE clause.
+	template <typename t_value>
+	void add_condition(std::string &where_clause, std::vector <parameter_type> &parameters, char const *condition, t_value &&value)
+	{
+		where_clause += (where_clause.empty() ? " WHERE " : " AND ");
+		where_clause += condition;
+		parameters.emplace_back(std::forward <t_value>(value));
+	}
+	
+	
+	// Resolve the identifier of a dictionary-encoded value before building the statement, so that the
+	// condition is a plain comparison that can use the index. The identifiers start from one, so
+	// zero (for unknown values) matches no rows.
+	std::int64_t lookup_id(sqlite::database &db, char const *column_name, std::string const &value)
+	{
+		std::int64_t retval{};
+		db << (std::string("SELECT id FROM lookup_") + column_name + " WHERE value = ?;") << value
+			>> [&retval](std::int64_t const id){ retval = id; };
+		return retval;
+	}
+	
+	
+	// Append the values within the given Hamming distance of value to the comma-separated list.
+	void append_chunk_values(std::uint16_t const value, std::uint8_t const distance, std::size_t const first_bit, std::string &list)
+	{
+		if (!list.empty())
+			list += ", ";
+		list += std::to_string(value);
+		
+		if (!distance)
+			return;
+		
+		for (auto bit(first_bit); bit < ii::PHASH_CHUNK_BITS; ++bit)
+			append_chunk_values(value ^ (1U << bit), distance - 1, 1 + bit, list);
+	}
+	
+	
+	struct similar_image
+	{
+		std::int64_t	id{};
+		std::string		filename;
+		std::int64_t	timestamp{};
+		std::uint8_t	phash_distance{};
+		std::uint8_t	dhash_distance{};
+		
+		bool operator<(similar_image const &other) const
+		{
+			return std::tie(phash_distance, dhash_distance, id) < std::tie(other.phash_distance, other.dhash_distance, other.id);
+		}
+	};
+}
+
+
+namespace index_images {
+	
+	void run_query(sqlite::database &db, query_arguments const &args, std::ostream &os)
+	{
+		// Build the statement. Each of the filters has a matching index on image_record, see prepare_schema().
+		// The dictionary-encoded values are compared by identifier, and the preview is not read.
+		std::string where_clause;
+		std::vector <parameter_type> parameters;
+		
+		if (args.project)
+			add_condition(where_clause, parameters, "r.project_id = ?", lookup_id(db, "project", *args.project));
+		if (args.lens_model)
+			add_condition(where_clause, parameters, "r.lens_model_id = ?", lookup_id(db, "lens_model", *args.lens_model));
+		if (args.text)
+			add_condition(where_clause, parameters, "r.id IN (SELECT rowid FROM image_fts WHERE image_fts MATCH ?)", fts_query(*args.text));
+		if (args.since)
+			add_condition(where_clause, parameters, "r.timestamp_us >= ?", *args.since * 1000000);
+		if (args.until)
+			add_condition(where_clause, parameters, "r.timestamp_us < ?", *args.until * 1000000);
+		if (args.min_rank)
+			add_condition(where_clause, parameters, "r.rank >= ?", std::int64_t(*args.min_rank));
+		if (args.max_clipped)
+			add_condition(where_clause, parameters, "r.clipped_fraction <= ?", *args.max_clipped);
+		if (args.max_dark)
+			add_condition(where_clause, parameters, "r.dark_fraction <= ?", *args.max_dark);
+		if (args.min_luminance)
+			add_condition(where_clause, parameters, "r.mean_luminance >= ?", *args.min_luminance);
+		if (args.sequence_id)
+			add_condition(where_clause, parameters, "r.sequence_id = ?", *args.sequence_id);
+		
+		std::string statement("SELECT ");
+		statement += image_select_list;
+		statement += " FROM ";
+		statement += image_from_clause;
+		statement += where_clause;
+		statement += " ORDER BY r.timestamp_us, r.id";
+		if (args.limit)
+		{
+			statement += " LIMIT ?";
+			parameters.emplace_back(*args.limit);
+		}
+		statement += ";";
+		
+		auto stmt(db << statement);
+		for (auto const &param : parameters)
+			std::visit([&stmt](auto const &val){ stmt << val; }, param);
+		
+		row_writer writer(os, args.format);
+		writer.write_header({
+			"id", "project", "filename", "timestamp", "artist", "copyright", "make", "model", "lens_model", "aperture", "focal_length", "iso",
+			"exposure_time_n", "exposure_time_d", "exposure_program", "flash", "rank", "orientation", "body_serial", "lens_serial",
+			"shutter_count", "gps_latitude", "gps_longitude", "gps_altitude", "clipped_fraction", "dark_fraction", "mean_luminance",
+			"sequence_id", "timestamp_us"
+		});
+		
+		stmt >> [&writer](
+			std::int64_t const id,
+			std::string const &project,
+			std::string const &filename,
+			std::int64_t const timestamp,
+			std::string const &artist,
+			std::string const &copyright,
+			std::string const &make,
+			std::string const &model,
+			std::string const &lens_model,
+			double const aperture,
+			double const focal_length,
+			double const iso,
+			std::int64_t const exposure_time_n,
+			std::int64_t const exposure_time_d,
+			std::int64_t const exposure_program,
+			std::int64_t const flash,
+			std::int64_t const rank,
+			std::int64_t const orientation,
+			std::string const &body_serial,
+			std::string const &lens_serial,
+			std::int64_t const shutter_count,
+			std::unique_ptr <double> const gps_latitude,
+			std::unique_ptr <double> const gps_longitude,
+			std::unique_ptr <double> const gps_altitude,
+			std::unique_ptr <double> const clipped_fraction,
+			std::unique_ptr <double> const dark_fraction,
+			std::unique_ptr <double> const mean_luminance,
+			std::unique_ptr <std::int64_t> const sequence_id,
+			std::unique_ptr <std::int64_t> const timestamp_us
+		){
+			writer.begin_row();
+			writer.write_field("id", id);
+			writer.write_field("project", project);
+			writer.write_field("filename", filename);
+			writer.write_field("timestamp", timestamp);
+			writer.write_field("artist", artist);
+			writer.write_field("copyright", copyright);
+			writer.write_field("make", make);
+			writer.write_field("model", model);
+			writer.write_field("lens_model", lens_model);
+			writer.write_field("aperture", aperture);
+			writer.write_field("focal_length", focal_length);
+			writer.write_field("iso", iso);
+			writer.write_field("exposure_time_n", exposure_time_n);
+			writer.write_field("exposure_time_d", exposure_time_d);
+			writer.write_field("exposure_program", exposure_program);
+			writer.write_field("flash", flash);
+			writer.write_field("rank", rank);
+			writer.write_field("orientation", orientation);
+			writer.write_field("body_serial", body_serial);
+			writer.write_field("lens_serial", lens_serial);
+			writer.write_field("shutter_count", shutter_count);
+			writer.write_field("gps_latitude", gps_latitude);
+			writer.write_field("gps_longitude", gps_longitude);
+			writer.write_field("gps_altitude", gps_altitude);
+			writer.write_field("clipped_fraction", clipped_fraction);
+			writer.write_field("dark_fraction", dark_fraction);
+			writer.write_field("mean_luminance", mean_luminance);
+			writer.write_field("sequence_id", sequence_id);
+			writer.write_field("timestamp_us", timestamp_us);
+			writer.end_row();
+		};
+	}
+	
+	
+	void run_similarity_query(sqlite::database &db, query_arguments const &args, std::ostream &os)
+	{
+		std::int64_t reference_id(0);
+		std::uint64_t reference_phash(0);
+		std::uint64_t reference_dhash(0);
+		db << u8"SELECT id, phash, dhash FROM image_record WHERE filename = ? AND phash IS NOT NULL LIMIT 1;" << *args.similar_to
+			>> [&](std::int64_t const id, std::int64_t const phash, std::int64_t const dhash){
+				reference_id = id;
+				reference_phash = phash;
+				reference_dhash = dhash;
+			};
+		
+		if (!reference_id)
+		{
+			std::cerr << "The image has not been indexed or it does not have a perceptual hash.\n";
+			return;
+		}
+		
+		// Find the candidates by looking up the chunk values within distance / PHASH_CHUNK_COUNT of the reference’s.
+		std::vector <std::int64_t> candidates;
+		std::uint8_t const chunk_distance(args.max_distance / PHASH_CHUNK_COUNT);
+		for (std::size_t i(0); i < PHASH_CHUNK_COUNT; ++i)
+		{
+			std::string values;
+			append_chunk_values(phash_chunk(reference_phash, i), chunk_distance, 0, values);
+			db << ("SELECT image_id FROM image_phash_chunk WHERE chunk = ? AND value IN (" + values + ");") << std::int64_t(i)
+				>> [&candidates, reference_id](std::int64_t const id){
+					// The reference image itself is not a result.
+					if (id != reference_id)
+						candidates.push_back(id);
+				};
+		}
+		
+		std::sort(candidates.begin(), candidates.end());
+		candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+		
+		// Verify the candidates with the full hashes.
+		std::vector <similar_image> images;
+		auto stmt(db << u8"SELECT filename, timestamp, phash, dhash FROM image_record WHERE id = ?;");
+		for (auto const id : candidates)
+		{
+			stmt << id >> [&](std::string const &filename, std::int64_t const timestamp, std::int64_t const phash, std::int64_t const dhash){
+				auto const phash_distance(hamming_distance(reference_phash, phash));
+				if (phash_distance <= args.max_distance)
+					images.push_back({id, filename, timestamp, phash_distance, hamming_distance(reference_dhash, dhash)});
+			};
+		}
+		
+		std::sort(images.begin(), images.end());
+		if (args.limit && std::size_t(*args.limit) < images.size())
+			images.resize(*args.limit);
+		
+		row_writer writer(os, args.format);
+		writer.write_header({"id", "filename", "timestamp", "phash_distance", "dhash_distance"});
+		for (auto const &image : images)
+		{
+			writer.begin_row();
+			writer.write_field("id", image.id);
+			writer.write_field("filename", image.filename);
+			writer.write_field("timestamp", image.timestamp);
+			writer.write_field("phash_distance", std::int64_t(image.phash_distance));
+			writer.write_field("dhash_distance", std::int64_t(image.dhash_distance));
+			writer.end_row();
+		}
+	}
+	
+	
+	void run_failure_report(sqlite::database &db, query_arguments const &args, std::ostream &os)
+	{
+		row_writer writer(os, args.format);
+		writer.write_header({"filename", "stage", "error_code", "message", "file_size", "file_mtime", "recorded_at"});
+		
+		// Databases that have not been indexed with this version do not have the table.
+		int has_failure_table(0);
+		db << u8"SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'failure';" >> has_failure_table;
+		if (!has_failure_table)
+			return;
+		
+		auto stmt(db
+			<< u8"SELECT filename, stage, error_code, message, file_size, file_mtime, recorded_at "
+			"FROM failure ORDER BY filename LIMIT ?;"
+		);
+		stmt << (args.limit ? *args.limit : std::int64_t(-1));
+		stmt >> [&writer](
+			std::string const &filename,
+			std::string const &stage,
+			std::int64_t const error_code,
+			std::string const &message,
+			std::int64_t const file_size,
+			std::int64_t const file_mtime,
+			std::int64_t const recorded_at
+		){
+			writer.begin_row();
+			writer.write_field("filename", filename);
+			writer.write_field("stage", stage);
+			writer.write_field("error_code", error_code);
+			writer.write_field("message", message);
+			writer.write_field("file_size", file_size);
+			writer.write_field("file_mtime", file_mtime);
+			writer.write_field("recorded_at", recorded_at);
+			writer.end_row();
+		};
+	}
+	
+	
+	void run_summary_report(sqlite::database &db, std::string const &dimension, output_format const format, std::ostream &os)
+	{
+		int has_summary_table(0);
+		db << u8"SELECT COUNT(*) FROM sqlite_master WHERE type = 'table' AND name = 'image_summary';" >> has_summary_table;
+		if (!has_summary_table)
+		{
+			std::cerr << "The database does not have the summary table yet. It is created when indexing.\n";
+			return;
+		}
+		
+		// Only the lookup table values of the listed rows are read.
+		auto stmt(db
+			<< u8"SELECT s.dimension, CASE s.dimension "
+			"WHEN 'project' THEN (SELECT value FROM lookup_project WHERE id = s.value) "
+			"WHEN 'lens_model' THEN (SELECT value FROM lookup_lens_model WHERE id = s.value) "
+			"WHEN 'model' THEN (SELECT value FROM lookup_model WHERE id = s.value) "
+			"ELSE CAST(s.value AS TEXT) END, "
+			"s.image_count, s.total_bytes "
+			"FROM image_summary s WHERE ? = '' OR s.dimension = ? ORDER BY s.dimension, s.value;"
+		);
+		
+		row_writer writer(os, format);
+		writer.write_header({"dimension", "value", "image_count", "total_bytes"});
+		stmt << dimension << dimension;
+		stmt >> [&writer](std::string const &dimension, std::unique_ptr <std::string> const &value, std::int64_t const image_count, std::int64_t const total_bytes){
+			writer.begin_row();
+			writer.write_field("dimension", dimension);
+			writer.write_field("value", value ? *value : std::string());
+			writer.write_field("image_count", image_count);
+			writer.write_field("total_bytes", total_bytes);
+			writer.end_row();
+		};
+	}
+}
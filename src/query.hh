@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_QUERY_HH
+#define INDEX_IMAGES_QUERY_HH
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <sqlite_modern_cpp.h>
+#include <string>
+
+
+namespace index_images {
+	
+	enum class output_format : std::uint8_t
+	{
+		TSV,
+		JSON		// One object per line.
+	};
+	
+	
+	// Filters for the query mode. Unset values do not restrict the result.
+	struct query_arguments
+	{
+		std::optional <std::string>		project;
+		std::optional <std::string>		lens_model;
+		std::optional <std::string>		text;		// Searched from the full-text index.
+		std::optional <std::int64_t>	since;		// Inclusive, UTC.
+		std::optional <std::int64_t>	until;		// Exclusive, UTC.
+		std::optional <std::int32_t>	min_rank;
+		std::optional <double>			max_clipped;		// Fraction of clipped photosites.
+		std::optional <double>			max_dark;			// Fraction of photosites near the black level.
+		std::optional <double>			min_luminance;		// Mean luminance relative to the white level.
+		std::optional <std::int64_t>	sequence_id;
+		std::optional <std::int64_t>	limit;
+		std::optional <std::string>		similar_to;		// Filename of an indexed image; the other filters are not applied.
+		std::uint8_t					max_distance{8};	// Maximum Hamming distance of the pHashes.
+		output_format					format{output_format::TSV};
+	};
+	
+	
+	// Run the filters in args against the image table and write the matching rows
+	// (excluding the preview) to os.
+	void run_query(sqlite::database &db, query_arguments const &args, std::ostream &os);
+	
+	// Find the images whose pHash is within args.max_distance of that of args.similar_to
+	// using the similarity index, and write them to os ordered by the distance.
+	void run_similarity_query(sqlite::database &db, query_arguments const &args, std::ostream &os);
+	
+	// Write the files that could not be processed to os. Only args.limit and args.format are used.
+	void run_failure_report(sqlite::database &db, query_arguments const &args, std::ostream &os);
+	
+	// Write the rows of the summary table to os with the dictionary-encoded values resolved.
+	// All dimensions are output if dimension is empty.
+	void run_summary_report(sqlite::database &db, std::string const &dimension, output_format const format, std::ostream &os);
+}
+
+#endif
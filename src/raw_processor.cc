@@ -15,7 +15,92 @@ namespace index_images {
 		// and including the headers is therefore not desired.
 		return new concrete_raw_processor();
 	}
-
+	
+	char const *to_string(processing_stage const stage)
+	{
+		switch (stage)
+		{
+			case processing_stage::NONE:
+				return "none";
+			case processing_stage::READ:
+				return "read";
+			case processing_stage::OPEN:
+				return "open";
+			case processing_stage::UNPACK:
+				return "unpack";
+			case processing_stage::PROCESS:
+				return "process";
+			case processing_stage::PREVIEW:
+				return "preview";
+			case processing_stage::METADATA:
+				return "metadata";
+			case processing_stage::TIMEOUT:
+				return "timeout";
+			case processing_stage::CRASH:
+				return "crash";
+		}
+		
+		return "unknown";
+	}
+	
+	
+	processing_stage processing_stage_from_string(std::string_view const name)
+	{
+		for (auto const stage : {
+			processing_stage::READ,
+			processing_stage::OPEN,
+			processing_stage::UNPACK,
+			processing_stage::PROCESS,
+			processing_stage::PREVIEW,
+			processing_stage::METADATA,
+			processing_stage::TIMEOUT,
+			processing_stage::CRASH
+		})
+		{
+			if (to_string(stage) == name)
+				return stage;
+		}
+		
+		return processing_stage::NONE;
+	}
+	
+	
+	void exif_properties::clear()
+	{
+		artist.clear();
+		copyright.clear();
+		make.clear();
+		model.clear();
+		lens_model.clear();
+		body_serial.clear();
+		lens_serial.clear();
+		gps = gps_position();
+		exposure_time = rational_type();
+		timestamp = 0;
+		wall_clock_time = 0;
+		shutter_count = 0;
+		subsec_time = 0;
+		utc_offset = 0;
+		aperture = 0;
+		focal_length = 0;
+		iso_speed = 0;
+		exposure_program = 0;
+		flash = 0;
+		orientation = 0;
+		has_utc_offset = false;
+	}
+	
+	
+	std::int64_t exif_properties::utc_timestamp_us() const
+	{
+		if (has_utc_offset && wall_clock_time)
+			return (wall_clock_time - utc_offset) * 1000000 + subsec_time;
+		if (timestamp)
+			return std::int64_t(timestamp) * 1000000 + subsec_time;
+		return 0;
+	}
+	
+	
 	std::ostream &operator<<(std::ostream &os, exif_properties const &properties)
 	{
 		std::cerr << "timestamp\t\t\t"		<< properties.timestamp			<< '\n';
@@ -37,6 +122,19 @@ namespace index_images {
 		std::cerr << "iso_speed\t\t\t"		<< properties.iso_speed			<< '\n';
 		std::cerr << "flash\t\t\t\t"		<< properties.flash				<< '\n';
 		std::cerr << "focal_length\t\t"		<< properties.focal_length		<< '\n';
+		std::cerr << "orientation\t\t\t"	<< properties.orientation		<< '\n';
+		std::cerr << "body_serial\t\t\t"	<< properties.body_serial		<< '\n';
+		std::cerr << "lens_serial\t\t\t"	<< properties.lens_serial		<< '\n';
+		std::cerr << "shutter_count\t\t"	<< properties.shutter_count		<< '\n';
+		
+		if (properties.gps.has_coordinates)
+		{
+			std::cerr << "gps_latitude\t\t"	<< properties.gps.signed_latitude()		<< '\n';
+			std::cerr << "gps_longitude\t\t"	<< properties.gps.signed_longitude()	<< '\n';
+		}
+		
+		if (properties.gps.has_altitude)
+			std::cerr << "gps_altitude\t\t"	<< properties.gps.signed_altitude()		<< '\n';
 		
 		return os;
 	}
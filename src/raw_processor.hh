@@ -8,8 +8,12 @@
 
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <utility>
+#include "exposure_statistics.hh"
+#include "perceptual_hash.hh"
+#include "sidecars.hh"
 
 
 namespace index_images {
@@ -20,6 +24,24 @@ namespace index_images {
 	class raw_processor;
 	
 	
+	struct gps_position
+	{
+		double			latitude{};			// Degrees.
+		double			longitude{};		// Degrees.
+		double			altitude{};			// Metres.
+		bool			is_south{};
+		bool			is_west{};
+		bool			is_below_sea_level{};
+		bool			has_coordinates{};
+		bool			has_altitude{};
+		
+		// The references may be read in any order relative to the values.
+		double signed_latitude() const { return is_south ? -latitude : latitude; }
+		double signed_longitude() const { return is_west ? -longitude : longitude; }
+		double signed_altitude() const { return is_below_sea_level ? -altitude : altitude; }
+	};
+	
+	
 	struct exif_properties
 	{
 		std::string		artist;
@@ -27,13 +49,29 @@ namespace index_images {
 		std::string		make;
 		std::string		model;
 		std::string		lens_model;
+		std::string		body_serial;
+		std::string		lens_serial;
+		gps_position	gps;
 		rational_type	exposure_time{};
-		std::uint64_t	timestamp{};
+		std::uint64_t	timestamp{};			// Seconds, local time.
+		std::int64_t	wall_clock_time{};		// Date and time as written in the file, in seconds as if it were UTC.
+		std::uint32_t	shutter_count{};
+		std::uint32_t	subsec_time{};			// Microseconds, from SubSecTimeOriginal.
+		std::int32_t	utc_offset{};			// Seconds, from OffsetTimeOriginal.
 		float			aperture{};
 		float			focal_length{};
 		float			iso_speed{};
 		std::uint16_t	exposure_program{};
 		std::uint16_t	flash{};
+		std::uint16_t	orientation{};
+		bool			has_utc_offset{};
+		
+		// Reset the values but retain the strings’ capacity.
+		void clear();
+		
+		// Microseconds since the epoch in UTC, or zero if the time is not known. If the file
+		// does not specify the UTC offset, the local time zone is assumed as for timestamp.
+		std::int64_t utc_timestamp_us() const;
 	};
 	
 	struct dop_properties
@@ -44,6 +82,37 @@ namespace index_images {
 	std::ostream &operator<<(std::ostream &os, exif_properties const &properties);
 	
 	
+	// The step in which processing an image failed.
+	enum class processing_stage : std::uint8_t
+	{
+		NONE = 0,
+		READ,			// Reading the file.
+		OPEN,			// LibRaw::open_datastream().
+		UNPACK,			// LibRaw::unpack().
+		PROCESS,		// LibRaw::dcraw_process().
+		PREVIEW,		// Copying, resizing or encoding the preview.
+		METADATA,		// Reading the metadata without LibRaw.
+		TIMEOUT,		// The decoding process exceeded the time limit.
+		CRASH			// The decoding process exited unexpectedly.
+	};
+	
+	char const *to_string(processing_stage const stage);
+	
+	// Inverse of to_string(). Returns NONE if the name is not recognised.
+	processing_stage processing_stage_from_string(std::string_view const name);
+	
+	
+	struct processing_failure
+	{
+		std::string			message;
+		processing_stage	stage{processing_stage::NONE};
+		int					error_code{};	// LibRaw error code or errno.
+		
+		bool has_failed() const { return processing_stage::NONE != stage; }
+		void clear() { message.clear(); stage = processing_stage::NONE; error_code = 0; }
+	};
+	
+	
 	// RAW processor base class.
 	class raw_processor
 	{
@@ -51,19 +120,36 @@ namespace index_images {
 		typedef std::vector <char>	buffer_type;
 		
 	protected:
-		buffer_type				m_buffer;
+		buffer_type				m_buffer;		// Preview.
+		buffer_type				m_thumbnail;
 		exif_properties			m_exif_properties;
 		dop_properties			m_dop_properties;
+		perceptual_hashes		m_hashes;		// Computed from the preview.
+		exposure_statistics		m_exposure_statistics;
+		processing_failure		m_failure;
+		std::uint16_t			m_thread_count{1};
+		std::uint8_t			m_sidecars{SIDECAR_UNKNOWN};
 		
 	public:
 		static raw_processor *instantiate();
 		virtual ~raw_processor() {}
-		virtual void prepare_file(std::string const &path) = 0;
+		virtual bool prepare_file(std::string const &path) = 0;	// Returns false and sets the failure if the file could not be unpacked.
 		virtual void process_image() = 0;
+		virtual void read_metadata(std::string const &path) = 0;	// Instead of prepare_file() and process_image().
 		buffer_type const &get_buffer() const { return m_buffer; }
+		buffer_type const &get_thumbnail() const { return m_thumbnail; }
 		exif_properties const &get_exif_properties() const { return m_exif_properties; }
 		exif_properties &get_exif_properties() { return m_exif_properties; }
 		dop_properties const &get_dop_properties() const { return m_dop_properties; }
+		perceptual_hashes const &get_hashes() const { return m_hashes; }
+		exposure_statistics const &get_exposure_statistics() const { return m_exposure_statistics; }
+		processing_failure const &get_failure() const { return m_failure; }
+		
+		// Number of threads LibRaw may use for processing the next image.
+		void set_thread_count(std::uint16_t const count) { m_thread_count = count; }
+		
+		// Sidecars of the next image (see sidecar_flags); only the ones that exist are read.
+		void set_sidecars(std::uint8_t const sidecars) { m_sidecars = sidecars; }
 		
 	protected:
 		raw_processor() = default;
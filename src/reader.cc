@@ -0,0 +1,361 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <index_images/reader.hh>
+#include <sqlite3.h>
+#include <stdexcept>
+#include <variant>
+#include <vector>
+#include "schema.hh"
+
+
+namespace {
+	
+	namespace ii = index_images;
+	
+	typedef std::variant <std::string, std::int64_t> parameter_type;
+	
+	
+	// In the order of image_select_list.
+	enum column_index : int
+	{
+		ID_COLUMN = 0,
+		PROJECT_COLUMN,
+		FILENAME_COLUMN,
+		TIMESTAMP_COLUMN,
+		ARTIST_COLUMN,
+		COPYRIGHT_COLUMN,
+		MAKE_COLUMN,
+		MODEL_COLUMN,
+		LENS_MODEL_COLUMN,
+		APERTURE_COLUMN,
+		FOCAL_LENGTH_COLUMN,
+		ISO_COLUMN,
+		EXPOSURE_TIME_N_COLUMN,
+		EXPOSURE_TIME_D_COLUMN,
+		EXPOSURE_PROGRAM_COLUMN,
+		FLASH_COLUMN,
+		RANK_COLUMN,
+		ORIENTATION_COLUMN,
+		BODY_SERIAL_COLUMN,
+		LENS_SERIAL_COLUMN,
+		SHUTTER_COUNT_COLUMN,
+		GPS_LATITUDE_COLUMN,
+		GPS_LONGITUDE_COLUMN,
+		GPS_ALTITUDE_COLUMN,
+		CLIPPED_FRACTION_COLUMN,
+		DARK_FRACTION_COLUMN,
+		MEAN_LUMINANCE_COLUMN,
+		SEQUENCE_ID_COLUMN,
+		TIMESTAMP_US_COLUMN,
+		BLOB_COLUMN
+	};
+	
+	
+	template <typename t_value>
+	void add_condition(std::string &where_clause, std::vector <parameter_type> &parameters, char const *condition, t_value &&value)
+	{
+		where_clause += (where_clause.empty() ? " WHERE " : " AND ");
+		where_clause += condition;
+		parameters.emplace_back(std::forward <t_value>(value));
+	}
+	
+	
+	sqlite3_stmt *prepare(sqlite3 *db, std::string const &statement)
+	{
+		sqlite3_stmt *stmt{};
+		if (SQLITE_OK != sqlite3_prepare_v2(db, statement.c_str(), -1, &stmt, nullptr))
+			throw std::runtime_error(sqlite3_errmsg(db));
+		return stmt;
+	}
+	
+	
+	void execute(sqlite3 *db, char const *statement)
+	{
+		if (SQLITE_OK != sqlite3_exec(db, statement, nullptr, nullptr, nullptr))
+			throw std::runtime_error(sqlite3_errmsg(db));
+	}
+	
+	
+	// Resolve the identifier of a dictionary-encoded value, so that the condition can use the index.
+	// The identifiers start from one, so zero (for unknown values) matches no rows.
+	std::int64_t lookup_id(sqlite3 *db, char const *column_name, std::string const &value)
+	{
+		auto *stmt(prepare(db, std::string("SELECT id FROM lookup_") + column_name + " WHERE value = ?;"));
+		sqlite3_bind_text(stmt, 1, value.data(), value.size(), SQLITE_TRANSIENT);
+		
+		std::int64_t retval{};
+		auto const res(sqlite3_step(stmt));
+		if (SQLITE_ROW == res)
+			retval = sqlite3_column_int64(stmt, 0);
+		sqlite3_finalize(stmt);
+		
+		if (SQLITE_ROW != res && SQLITE_DONE != res)
+			throw std::runtime_error(sqlite3_errmsg(db));
+		
+		return retval;
+	}
+}
+
+
+namespace index_images {
+	
+	std::int64_t image_row::id() const								{ return sqlite3_column_int64(m_stmt, ID_COLUMN); }
+	std::string_view image_row::project() const						{ return text_column(PROJECT_COLUMN); }
+	std::string_view image_row::filename() const					{ return text_column(FILENAME_COLUMN); }
+	std::uint64_t image_row::timestamp() const						{ return sqlite3_column_int64(m_stmt, TIMESTAMP_COLUMN); }
+	std::int64_t image_row::timestamp_us() const					{ return sqlite3_column_int64(m_stmt, TIMESTAMP_US_COLUMN); }
+	std::string_view image_row::artist() const						{ return text_column(ARTIST_COLUMN); }
+	std::string_view image_row::copyright() const					{ return text_column(COPYRIGHT_COLUMN); }
+	std::string_view image_row::make() const						{ return text_column(MAKE_COLUMN); }
+	std::string_view image_row::model() const						{ return text_column(MODEL_COLUMN); }
+	std::string_view image_row::lens_model() const					{ return text_column(LENS_MODEL_COLUMN); }
+	std::string_view image_row::body_serial() const					{ return text_column(BODY_SERIAL_COLUMN); }
+	std::string_view image_row::lens_serial() const					{ return text_column(LENS_SERIAL_COLUMN); }
+	std::uint32_t image_row::shutter_count() const					{ return sqlite3_column_int64(m_stmt, SHUTTER_COUNT_COLUMN); }
+	float image_row::aperture() const								{ return sqlite3_column_double(m_stmt, APERTURE_COLUMN); }
+	float image_row::focal_length() const							{ return sqlite3_column_double(m_stmt, FOCAL_LENGTH_COLUMN); }
+	float image_row::iso_speed() const								{ return sqlite3_column_double(m_stmt, ISO_COLUMN); }
+	std::uint16_t image_row::exposure_program() const				{ return sqlite3_column_int(m_stmt, EXPOSURE_PROGRAM_COLUMN); }
+	std::uint16_t image_row::flash() const							{ return sqlite3_column_int(m_stmt, FLASH_COLUMN); }
+	std::uint16_t image_row::orientation() const					{ return sqlite3_column_int(m_stmt, ORIENTATION_COLUMN); }
+	std::optional <double> image_row::gps_latitude() const			{ return real_column(GPS_LATITUDE_COLUMN); }
+	std::optional <double> image_row::gps_longitude() const			{ return real_column(GPS_LONGITUDE_COLUMN); }
+	std::optional <double> image_row::gps_altitude() const			{ return real_column(GPS_ALTITUDE_COLUMN); }
+	std::int32_t image_row::rank() const							{ return sqlite3_column_int(m_stmt, RANK_COLUMN); }
+	std::optional <double> image_row::clipped_fraction() const		{ return real_column(CLIPPED_FRACTION_COLUMN); }
+	std::optional <double> image_row::dark_fraction() const			{ return real_column(DARK_FRACTION_COLUMN); }
+	std::optional <double> image_row::mean_luminance() const		{ return real_column(MEAN_LUMINANCE_COLUMN); }
+	
+	
+	std::optional <std::int64_t> image_row::sequence_id() const
+	{
+		if (SQLITE_NULL == sqlite3_column_type(m_stmt, SEQUENCE_ID_COLUMN))
+			return std::nullopt;
+		return sqlite3_column_int64(m_stmt, SEQUENCE_ID_COLUMN);
+	}
+	
+	
+	auto image_row::exposure_time() const -> std::pair <std::uint32_t, std::uint32_t>
+	{
+		return {sqlite3_column_int64(m_stmt, EXPOSURE_TIME_N_COLUMN), sqlite3_column_int64(m_stmt, EXPOSURE_TIME_D_COLUMN)};
+	}
+	
+	
+	blob_span image_row::blob() const
+	{
+		if (sqlite3_column_count(m_stmt) <= BLOB_COLUMN)
+			return blob_span();
+		
+		// The pointer needs to be retrieved before the size.
+		auto const *data(static_cast <std::byte const *>(sqlite3_column_blob(m_stmt, BLOB_COLUMN)));
+		return blob_span(data, sqlite3_column_bytes(m_stmt, BLOB_COLUMN));
+	}
+	
+	
+	std::string_view image_row::text_column(int const idx) const
+	{
+		auto const *text(reinterpret_cast <char const *>(sqlite3_column_text(m_stmt, idx)));
+		if (!text)
+			return std::string_view();
+		return std::string_view(text, sqlite3_column_bytes(m_stmt, idx));
+	}
+	
+	
+	std::optional <double> image_row::real_column(int const idx) const
+	{
+		if (SQLITE_NULL == sqlite3_column_type(m_stmt, idx))
+			return std::nullopt;
+		return sqlite3_column_double(m_stmt, idx);
+	}
+	
+	
+	image_range::image_range(sqlite3_stmt *stmt)
+	{
+		m_row.m_stmt = stmt;
+		step();
+	}
+	
+	
+	image_range::~image_range()
+	{
+		sqlite3_finalize(m_row.m_stmt);
+	}
+	
+	
+	image_range::image_range(image_range &&other):
+		m_is_at_end(other.m_is_at_end)
+	{
+		m_row.m_stmt = other.m_row.m_stmt;
+		other.m_row.m_stmt = nullptr;
+		other.m_is_at_end = true;
+	}
+	
+	
+	image_range &image_range::operator=(image_range &&other)
+	{
+		if (this != &other)
+		{
+			sqlite3_finalize(m_row.m_stmt);
+			m_row.m_stmt = other.m_row.m_stmt;
+			m_is_at_end = other.m_is_at_end;
+			other.m_row.m_stmt = nullptr;
+			other.m_is_at_end = true;
+		}
+		return *this;
+	}
+	
+	
+	void image_range::step()
+	{
+		auto const st(sqlite3_step(m_row.m_stmt));
+		if (SQLITE_ROW == st)
+		{
+			m_is_at_end = false;
+			return;
+		}
+		
+		m_is_at_end = true;
+		if (SQLITE_DONE != st)
+			throw std::runtime_error(sqlite3_errmsg(sqlite3_db_handle(m_row.m_stmt)));
+	}
+	
+	
+	auto image_range::iterator::operator++() -> iterator &
+	{
+		m_range->step();
+		if (m_range->m_is_at_end)
+			m_range = nullptr;
+		return *this;
+	}
+	
+	
+	image_reader::image_reader(std::string const &path)
+	{
+		if (SQLITE_OK != sqlite3_open_v2(path.c_str(), &m_db, SQLITE_OPEN_READONLY, nullptr))
+		{
+			std::string const message(sqlite3_errmsg(m_db));
+			sqlite3_close(m_db);
+			throw std::runtime_error(message);
+		}
+		
+		// Let SQLite read the pages directly from a memory mapping where possible.
+		sqlite3_exec(m_db, "PRAGMA mmap_size = 1073741824;", nullptr, nullptr, nullptr);
+	}
+	
+	
+	image_reader::~image_reader()
+	{
+		for (auto *stmt : m_blob_statements)
+			sqlite3_finalize(stmt);
+		sqlite3_close(m_db);
+	}
+	
+	
+	image_range image_reader::rows(row_filter const &filter)
+	{
+		std::string where_clause;
+		std::vector <parameter_type> parameters;
+		
+		if (filter.project)
+			add_condition(where_clause, parameters, "r.project_id = ?", lookup_id(m_db, "project", *filter.project));
+		if (filter.lens_model)
+			add_condition(where_clause, parameters, "r.lens_model_id = ?", lookup_id(m_db, "lens_model", *filter.lens_model));
+		if (filter.since)
+			add_condition(where_clause, parameters, "r.timestamp_us >= ?", *filter.since * 1000000);
+		if (filter.until)
+			add_condition(where_clause, parameters, "r.timestamp_us < ?", *filter.until * 1000000);
+		if (filter.min_rank)
+			add_condition(where_clause, parameters, "r.rank >= ?", std::int64_t(*filter.min_rank));
+		if (filter.sequence_id)
+			add_condition(where_clause, parameters, "r.sequence_id = ?", *filter.sequence_id);
+		
+		std::string statement("SELECT ");
+		statement += image_select_list;
+		if (filter.blob)
+			statement += (blob_kind::THUMBNAIL == *filter.blob ? ", COALESCE(r.thumbnail, r.preview)" : ", r.preview");
+		statement += " FROM ";
+		statement += image_from_clause;
+		statement += where_clause;
+		statement += " ORDER BY r.timestamp_us, r.id";
+		if (filter.limit)
+		{
+			statement += " LIMIT ?";
+			parameters.emplace_back(*filter.limit);
+		}
+		statement += ";";
+		
+		auto *stmt(prepare(m_db, statement));
+		int idx(1);
+		for (auto const &param : parameters)
+		{
+			std::visit([stmt, idx](auto const &val){
+				if constexpr (std::is_same_v <std::string, std::decay_t <decltype(val)>>)
+					sqlite3_bind_text(stmt, idx, val.data(), val.size(), SQLITE_TRANSIENT);
+				else
+					sqlite3_bind_int64(stmt, idx, val);
+			}, param);
+			++idx;
+		}
+		
+		try
+		{
+			return image_range(stmt);
+		}
+		catch (...)
+		{
+			// image_range’s destructor is not called if its constructor throws.
+			sqlite3_finalize(stmt);
+			throw;
+		}
+	}
+	
+	
+	void image_reader::begin_read()
+	{
+		execute(m_db, "BEGIN;");
+	}
+	
+	
+	void image_reader::end_read()
+	{
+		// The read lock is only released once no statement is active.
+		reset_blob_statements();
+		execute(m_db, "COMMIT;");
+	}
+	
+	
+	void image_reader::reset_blob_statements()
+	{
+		for (auto *stmt : m_blob_statements)
+		{
+			if (stmt)
+				sqlite3_reset(stmt);
+		}
+	}
+	
+	
+	// Returns an empty span if the row does not exist or the value is NULL or missing.
+	blob_span image_reader::read_blob(std::int64_t const id, blob_kind const kind)
+	{
+		auto const idx(static_cast <std::size_t>(kind));
+		auto *&stmt(m_blob_statements[idx]);
+		if (!stmt)
+		{
+			// Databases created before the thumbnails were added do not have the column.
+			auto const *statement(blob_kind::THUMBNAIL == kind ? "SELECT thumbnail FROM image_record WHERE id = ?;" : "SELECT preview FROM image_record WHERE id = ?;");
+			if (SQLITE_OK != sqlite3_prepare_v2(m_db, statement, -1, &stmt, nullptr))
+				return blob_span();
+		}
+		
+		sqlite3_reset(stmt);
+		sqlite3_bind_int64(stmt, 1, id);
+		if (SQLITE_ROW != sqlite3_step(stmt))
+			return blob_span();
+		
+		auto const *data(static_cast <std::byte const *>(sqlite3_column_blob(stmt, 0)));
+		return blob_span(data, sqlite3_column_bytes(stmt, 0));
+	}
+}
@@ -0,0 +1,519 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "perceptual_hash.hh"
+#include "schema.hh"
+
+
+namespace {
+	
+	namespace ii = index_images;
+	
+	
+	bool has_object(sqlite::database &db, char const *type, char const *name)
+	{
+		int count(0);
+		db << u8"SELECT COUNT(*) FROM sqlite_master WHERE type = ? AND name = ?;" << type << name >> count;
+		return 0 < count;
+	}
+	
+	
+	struct column_definition
+	{
+		char const	*name{};
+		char const	*type{};
+	};
+	
+	
+	// The preview is stored in the last column, so reading the other columns of a row
+	// does not touch its overflow pages. The thumbnail precedes it for the same reason.
+	column_definition const image_record_columns[]{
+		{"id",					"INTEGER PRIMARY KEY"},
+		{"project_id",			"INTEGER"},
+		{"filename",			"TEXT"},
+		{"timestamp",			"INTEGER"},
+		{"timestamp_us",		"INTEGER"},		// UTC.
+		{"artist_id",			"INTEGER"},
+		{"copyright_id",		"INTEGER"},
+		{"make_id",				"INTEGER"},
+		{"model_id",			"INTEGER"},
+		{"lens_model_id",		"INTEGER"},
+		{"aperture",			"REAL"},
+		{"focal_length",		"REAL"},
+		{"iso",					"REAL"},
+		{"exposure_time_n",		"INTEGER"},
+		{"exposure_time_d",		"INTEGER"},
+		{"exposure_program",	"INTEGER"},
+		{"flash",				"INTEGER"},
+		{"rank",				"INTEGER"},
+		{"orientation",			"INTEGER"},
+		{"body_serial",			"TEXT"},
+		{"lens_serial",			"TEXT"},
+		{"shutter_count",		"INTEGER"},
+		{"gps_latitude",		"REAL"},
+		{"gps_longitude",		"REAL"},
+		{"gps_altitude",		"REAL"},
+		{"phash",				"INTEGER"},
+		{"dhash",				"INTEGER"},
+		{"clipped_fraction",	"REAL"},
+		{"dark_fraction",		"REAL"},
+		{"mean_luminance",		"REAL"},
+		{"sequence_id",			"INTEGER"},
+		{"raw_histogram",		"BLOB"},
+		{"thumbnail",			"BLOB"},
+		{"preview",				"BLOB"}
+	};
+	
+	
+	void create_image_record_table(sqlite::database &db, char const *table_name)
+	{
+		std::string statement("CREATE TABLE IF NOT EXISTS ");
+		statement += table_name;
+		statement += " (";
+		bool is_first(true);
+		for (auto const &column : image_record_columns)
+		{
+			if (!is_first)
+				statement += ", ";
+			statement += column.name;
+			statement += ' ';
+			statement += column.type;
+			is_first = false;
+		}
+		statement += ");";
+		db << statement;
+	}
+	
+	
+	// Recreate the compatibility view with the original flat shape, so that it includes any new columns.
+	void create_image_view(sqlite::database &db)
+	{
+		db << u8"DROP VIEW IF EXISTS image;";
+		db << (std::string("CREATE VIEW image AS SELECT ") + ii::image_select_list + ", r.preview AS preview FROM " + ii::image_from_clause + ";");
+	}
+	
+	
+	void create_tables(sqlite::database &db)
+	{
+		for (auto const *name : ii::dictionary_column_names)
+		{
+			db << (
+				std::string("CREATE TABLE IF NOT EXISTS lookup_") + name + " (	"
+				"	id		INTEGER PRIMARY KEY,								"
+				"	value	TEXT NOT NULL UNIQUE								"
+				");																"
+			);
+		}
+		
+		create_image_record_table(db, "image_record");
+		create_image_view(db);
+	}
+	
+	
+	// Multi-index hashing table for the similarity search. Each pHash is stored as PHASH_CHUNK_COUNT rows,
+	// so that the candidates can be found with exact lookups of the chunk values near the query’s.
+	void create_similarity_index(sqlite::database &db)
+	{
+		db << u8""
+			"CREATE TABLE IF NOT EXISTS image_phash_chunk (	"
+			"	chunk		INTEGER NOT NULL,				"
+			"	value		INTEGER NOT NULL,				"
+			"	image_id	INTEGER NOT NULL,				"
+			"	PRIMARY KEY (chunk, value, image_id)		"
+			") WITHOUT ROWID;								"
+		"";
+	}
+	
+	
+	// Dimensions of the summary table. The expressions refer to the row with ROW.
+	struct summary_dimension
+	{
+		char const	*name{};
+		char const	*expression{};
+	};
+	
+	
+	summary_dimension const summary_dimensions[]{
+		{"all",			"0"},
+		{"project",		"IFNULL(ROW.project_id, 0)"},
+		{"lens_model",	"IFNULL(ROW.lens_model_id, 0)"},
+		{"model",		"IFNULL(ROW.model_id, 0)"},
+		{"month",		"IFNULL(CAST(strftime('%Y%m', ROW.timestamp, 'unixepoch') AS INTEGER), 0)"},
+		{"rank",		"IFNULL(ROW.rank, 0)"}
+	};
+	
+	char const * const summary_bytes_expression{"IFNULL(LENGTH(ROW.thumbnail), 0) + IFNULL(LENGTH(ROW.preview), 0)"};
+	
+	
+	// Replace ROW with the given name.
+	std::string summary_expression(char const *expression, char const *row)
+	{
+		std::string retval(expression);
+		std::string::size_type pos(0);
+		while (std::string::npos != (pos = retval.find("ROW.", pos)))
+		{
+			retval.replace(pos, 3, row);
+			pos += std::strlen(row);
+		}
+		return retval;
+	}
+	
+	
+	// Statements for adding the given row to the summary table or removing it.
+	std::string summary_update_statements(char const *row, bool const is_removal)
+	{
+		std::string values;
+		std::string condition;
+		for (auto const &dimension : summary_dimensions)
+		{
+			auto const expression(summary_expression(dimension.expression, row));
+			if (!values.empty())
+			{
+				values += ", ";
+				condition += " OR ";
+			}
+			
+			values += std::string("('") + dimension.name + "', " + expression + ", 0, 0)";
+			condition += std::string("(dimension = '") + dimension.name + "' AND value = " + expression + ")";
+		}
+		
+		auto const bytes(summary_expression(summary_bytes_expression, row));
+		if (is_removal)
+		{
+			return
+				"UPDATE image_summary SET image_count = image_count - 1, total_bytes = total_bytes - (" + bytes + ") WHERE " + condition + "; "
+				"DELETE FROM image_summary WHERE image_count = 0 AND (" + condition + "); ";
+		}
+		
+		return
+			"INSERT OR IGNORE INTO image_summary (dimension, value, image_count, total_bytes) VALUES " + values + "; "
+			"UPDATE image_summary SET image_count = image_count + 1, total_bytes = total_bytes + (" + bytes + ") WHERE " + condition + "; ";
+	}
+	
+	
+	// Counts and sizes of the images per project, lens model etc. The dictionary-encoded values
+	// are stored as identifiers.
+	void create_summary_table(sqlite::database &db)
+	{
+		db << u8""
+			"CREATE TABLE IF NOT EXISTS image_summary (	"
+			"	dimension	TEXT NOT NULL,				"
+			"	value		INTEGER NOT NULL,			"
+			"	image_count	INTEGER NOT NULL,			"
+			"	total_bytes	INTEGER NOT NULL,			"
+			"	PRIMARY KEY (dimension, value)			"
+			") WITHOUT ROWID;							"
+		"";
+	}
+	
+	
+	// Files whose processing failed. They are skipped until their size or modification time changes.
+	void create_failure_table(sqlite::database &db)
+	{
+		db << u8""
+			"CREATE TABLE IF NOT EXISTS failure (	"
+			"	filename	TEXT PRIMARY KEY,		"
+			"	stage		TEXT NOT NULL,			"
+			"	error_code	INTEGER,				"
+			"	message		TEXT,					"
+			"	file_size	INTEGER,				"
+			"	file_mtime	INTEGER,				"
+			"	recorded_at	INTEGER					"
+			");										"
+		"";
+	}
+	
+	
+	// Rebuild image_record if it lacks some of the current columns. Adding the columns with
+	// ALTER TABLE would place them after the preview, so the table is copied instead.
+	// The row identifiers are retained, so the full-text index remains valid.
+	void upgrade_image_record(sqlite::database &db)
+	{
+		std::vector <std::string> existing_columns;
+		db << u8"SELECT name FROM pragma_table_info('image_record');" >> [&existing_columns](std::string const &name){
+			existing_columns.emplace_back(name);
+		};
+		
+		std::string common_columns;
+		bool needs_upgrade(false);
+		for (auto const &column : image_record_columns)
+		{
+			if (existing_columns.end() == std::find(existing_columns.begin(), existing_columns.end(), column.name))
+			{
+				needs_upgrade = true;
+				continue;
+			}
+			
+			if (!common_columns.empty())
+				common_columns += ", ";
+			common_columns += column.name;
+		}
+		
+		if (!needs_upgrade)
+			return;
+		
+		std::cerr << "Adding new columns to image_record…\n";
+		db << u8"DROP VIEW IF EXISTS image;";
+		ii::drop_indices(db);
+		create_image_record_table(db, "image_record_new");
+		db << ("INSERT INTO image_record_new (" + common_columns + ") SELECT " + common_columns + " FROM image_record;");
+		db << u8"DROP TABLE image_record;";
+		db << u8"ALTER TABLE image_record_new RENAME TO image_record;";
+	}
+	
+	
+	// Convert the flat image table to image_record and the lookup tables. The row identifiers
+	// are retained, so the full-text index remains valid.
+	void convert_flat_image_table(sqlite::database &db)
+	{
+		db << u8"ALTER TABLE image RENAME TO image_flat;";
+		create_tables(db);
+		
+		// Convert the text to identifiers.
+		std::string select_ids;
+		for (auto const *name : ii::dictionary_column_names)
+		{
+			db << (std::string("INSERT OR IGNORE INTO lookup_") + name + " (value) SELECT DISTINCT " + name + " FROM image_flat WHERE " + name + " IS NOT NULL;");
+			select_ids += std::string(", (SELECT id FROM lookup_") + name + " WHERE value = f." + name + ")";
+		}
+		
+		db << (
+			"INSERT INTO image_record ("
+			"id, filename, timestamp, aperture, focal_length, iso, exposure_time_n, exposure_time_d, exposure_program, flash, rank, preview, "
+			"project_id, artist_id, copyright_id, make_id, model_id, lens_model_id"
+			") SELECT "
+			"f.id, f.filename, f.timestamp, f.aperture, f.focal_length, f.iso, f.exposure_time_n, f.exposure_time_d, f.exposure_program, f.flash, f.rank, f.preview"
+			+ select_ids +
+			" FROM image_flat f;"
+		);
+		
+		db << u8"DROP TABLE image_flat;";
+	}
+}
+
+
+namespace index_images {
+	
+	std::array <char const *, DICTIONARY_COLUMN_COUNT> const dictionary_column_names{
+		"project",
+		"artist",
+		"copyright",
+		"make",
+		"model",
+		"lens_model"
+	};
+	
+	
+	char const * const image_select_list{
+		"r.id AS id, lookup_project.value AS project, r.filename AS filename, r.timestamp AS timestamp, "
+		"lookup_artist.value AS artist, lookup_copyright.value AS copyright, lookup_make.value AS make, "
+		"lookup_model.value AS model, lookup_lens_model.value AS lens_model, r.aperture AS aperture, "
+		"r.focal_length AS focal_length, r.iso AS iso, r.exposure_time_n AS exposure_time_n, "
+		"r.exposure_time_d AS exposure_time_d, r.exposure_program AS exposure_program, r.flash AS flash, "
+		"r.rank AS rank, r.orientation AS orientation, r.body_serial AS body_serial, r.lens_serial AS lens_serial, "
+		"r.shutter_count AS shutter_count, r.gps_latitude AS gps_latitude, r.gps_longitude AS gps_longitude, "
+		"r.gps_altitude AS gps_altitude, r.clipped_fraction AS clipped_fraction, r.dark_fraction AS dark_fraction, "
+		"r.mean_luminance AS mean_luminance, r.sequence_id AS sequence_id, r.timestamp_us AS timestamp_us"
+	};
+	
+	
+	char const * const image_record_value_columns{
+		"filename, timestamp, timestamp_us, aperture, focal_length, iso, exposure_time_n, exposure_time_d, exposure_program, flash, rank, "
+		"orientation, body_serial, lens_serial, shutter_count, gps_latitude, gps_longitude, gps_altitude, phash, dhash, "
+		"clipped_fraction, dark_fraction, mean_luminance, raw_histogram, thumbnail, preview"
+	};
+	
+	
+	char const * const image_from_clause{
+		"image_record r "
+		"LEFT JOIN lookup_project ON lookup_project.id = r.project_id "
+		"LEFT JOIN lookup_artist ON lookup_artist.id = r.artist_id "
+		"LEFT JOIN lookup_copyright ON lookup_copyright.id = r.copyright_id "
+		"LEFT JOIN lookup_make ON lookup_make.id = r.make_id "
+		"LEFT JOIN lookup_model ON lookup_model.id = r.model_id "
+		"LEFT JOIN lookup_lens_model ON lookup_lens_model.id = r.lens_model_id"
+	};
+	
+	
+	// Indices for the common access paths. The queries are ordered by timestamp_us.
+	void create_indices(sqlite::database &db)
+	{
+		db << u8"CREATE INDEX IF NOT EXISTS image_record_project_id_timestamp_us ON image_record (project_id, timestamp_us);";
+		db << u8"CREATE INDEX IF NOT EXISTS image_record_lens_model_id_timestamp_us ON image_record (lens_model_id, timestamp_us);";
+		db << u8"CREATE INDEX IF NOT EXISTS image_record_rank_timestamp_us ON image_record (rank, timestamp_us);";
+		create_filename_index(db);
+		db << u8"CREATE INDEX IF NOT EXISTS image_record_clipped_fraction ON image_record (clipped_fraction);";
+		db << u8"CREATE INDEX IF NOT EXISTS image_record_dark_fraction ON image_record (dark_fraction);";
+		db << u8"CREATE INDEX IF NOT EXISTS image_record_mean_luminance ON image_record (mean_luminance);";
+		db << u8"CREATE INDEX IF NOT EXISTS image_record_timestamp_us ON image_record (timestamp_us);";
+		db << u8"CREATE INDEX IF NOT EXISTS image_record_sequence_timestamp_us ON image_record (sequence_id, timestamp_us);";
+	}
+	
+	
+	void create_filename_index(sqlite::database &db)
+	{
+		db << u8"CREATE INDEX IF NOT EXISTS image_record_filename ON image_record (filename);";
+	}
+	
+	
+	void drop_indices(sqlite::database &db)
+	{
+		db << u8"DROP INDEX IF EXISTS image_record_project_id_timestamp_us;";
+		db << u8"DROP INDEX IF EXISTS image_record_lens_model_id_timestamp_us;";
+		db << u8"DROP INDEX IF EXISTS image_record_rank_timestamp_us;";
+		db << u8"DROP INDEX IF EXISTS image_record_filename;";
+		db << u8"DROP INDEX IF EXISTS image_record_clipped_fraction;";
+		db << u8"DROP INDEX IF EXISTS image_record_dark_fraction;";
+		db << u8"DROP INDEX IF EXISTS image_record_mean_luminance;";
+		db << u8"DROP INDEX IF EXISTS image_record_timestamp_us;";
+		db << u8"DROP INDEX IF EXISTS image_record_sequence_timestamp_us;";
+	}
+	
+	
+	// Keep image_summary up to date.
+	void create_summary_triggers(sqlite::database &db)
+	{
+		db << (
+			"CREATE TRIGGER IF NOT EXISTS image_record_summary_insert AFTER INSERT ON image_record BEGIN "
+			+ summary_update_statements("NEW", false) +
+			"END;"
+		);
+		
+		db << (
+			"CREATE TRIGGER IF NOT EXISTS image_record_summary_delete AFTER DELETE ON image_record BEGIN "
+			+ summary_update_statements("OLD", true) +
+			"END;"
+		);
+		
+		db << (
+			"CREATE TRIGGER IF NOT EXISTS image_record_summary_update "
+			"AFTER UPDATE OF project_id, lens_model_id, model_id, timestamp, rank, thumbnail, preview ON image_record BEGIN "
+			+ summary_update_statements("OLD", true)
+			+ summary_update_statements("NEW", false) +
+			"END;"
+		);
+	}
+	
+	
+	void drop_summary_triggers(sqlite::database &db)
+	{
+		db << u8"DROP TRIGGER IF EXISTS image_record_summary_insert;";
+		db << u8"DROP TRIGGER IF EXISTS image_record_summary_delete;";
+		db << u8"DROP TRIGGER IF EXISTS image_record_summary_update;";
+	}
+	
+	
+	void rebuild_summary(sqlite::database &db)
+	{
+		db << u8"DELETE FROM image_summary;";
+		auto const bytes(summary_expression(summary_bytes_expression, "r"));
+		for (auto const &dimension : summary_dimensions)
+		{
+			db << (
+				std::string("INSERT INTO image_summary (dimension, value, image_count, total_bytes) ")
+				+ "SELECT '" + dimension.name + "', " + summary_expression(dimension.expression, "r") + ", COUNT(*), SUM(" + bytes + ") "
+				"FROM image_record r GROUP BY 2;"
+			);
+		}
+	}
+	
+	
+	void rebuild_full_text_index(sqlite::database &db)
+	{
+		db << u8"INSERT INTO image_fts (image_fts) VALUES ('rebuild');";
+	}
+	
+	
+	void rebuild_similarity_index(sqlite::database &db)
+	{
+		static_assert(4 == PHASH_CHUNK_COUNT && 16 == PHASH_CHUNK_BITS);
+		db << u8"DELETE FROM image_phash_chunk;";
+		db << u8""
+			"INSERT INTO image_phash_chunk (chunk, value, image_id)									"
+			"SELECT c.chunk, (r.phash >> (16 * c.chunk)) & 65535, r.id								"
+			"FROM image_record r,																	"
+			"	(SELECT 0 AS chunk UNION ALL SELECT 1 UNION ALL SELECT 2 UNION ALL SELECT 3) c		"
+			"WHERE r.phash IS NOT NULL;																"
+		"";
+	}
+	
+	
+	void add_to_similarity_index(sqlite::database &db, std::int64_t const image_id, std::uint64_t const phash)
+	{
+		auto stmt(db << u8"INSERT OR IGNORE INTO image_phash_chunk (chunk, value, image_id) VALUES (?, ?, ?);");
+		for (std::size_t i(0); i < PHASH_CHUNK_COUNT; ++i)
+		{
+			stmt << std::int64_t(i) << std::int64_t(phash_chunk(phash, i)) << image_id;
+			stmt.execute();
+		}
+	}
+	
+	
+	void remove_from_similarity_index(sqlite::database &db, std::int64_t const image_id, std::uint64_t const phash)
+	{
+		auto stmt(db << u8"DELETE FROM image_phash_chunk WHERE chunk = ? AND value = ? AND image_id = ?;");
+		for (std::size_t i(0); i < PHASH_CHUNK_COUNT; ++i)
+		{
+			stmt << std::int64_t(i) << std::int64_t(phash_chunk(phash, i)) << image_id;
+			stmt.execute();
+		}
+	}
+	
+	
+	void prepare_schema(sqlite::database &db)
+	{
+		db << u8"BEGIN;";
+		
+		if (has_object(db, "table", "image"))
+			convert_flat_image_table(db);
+		else
+		{
+			if (has_object(db, "table", "image_record"))
+				upgrade_image_record(db);
+			create_tables(db);
+		}
+		
+		create_indices(db);
+		create_failure_table(db);
+		
+		// Rows added before timestamp_us only have the timestamp in seconds. The index on timestamp_us
+		// is used for finding them.
+		db << u8"UPDATE image_record SET timestamp_us = timestamp * 1000000 WHERE timestamp_us IS NULL AND timestamp != 0;";
+		
+		// The triggers are removed with image_record when it is rebuilt and when merging.
+		auto const has_summary_triggers(has_object(db, "trigger", "image_record_summary_insert"));
+		create_summary_table(db);
+		create_summary_triggers(db);
+		if (!has_summary_triggers)
+			rebuild_summary(db);
+		
+		// Full-text index over the textual metadata. The content is read from the image view
+		// when needed, so only the inverted index is stored.
+		auto const has_fts_table(has_object(db, "table", "image_fts"));
+		db << u8""
+			"CREATE VIRTUAL TABLE IF NOT EXISTS image_fts USING fts5 (			"
+			"	filename, project, artist, copyright, make, model, lens_model,	"
+			"	content = 'image', content_rowid = 'id'							"
+			");																	"
+		"";
+		
+		// Index the existing rows if the table was just created.
+		if (!has_fts_table)
+			rebuild_full_text_index(db);
+		
+		// Similarly for the similarity index.
+		auto const has_similarity_index(has_object(db, "table", "image_phash_chunk"));
+		create_similarity_index(db);
+		if (!has_similarity_index)
+			rebuild_similarity_index(db);
+		
+		db << u8"COMMIT;";
+	}
+}
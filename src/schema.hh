@@ -0,0 +1,63 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_SCHEMA_HH
+#define INDEX_IMAGES_SCHEMA_HH
+
+#include <array>
+#include <cstdint>
+#include <sqlite_modern_cpp.h>
+
+
+namespace index_images {
+	
+	// Dictionary-encoded columns. Each has a lookup table named lookup_<column> with the columns
+	// id and value, and image_record has <column>_id in place of the text.
+	enum dictionary_column : std::uint8_t
+	{
+		PROJECT = 0,
+		ARTIST,
+		COPYRIGHT,
+		MAKE,
+		MODEL,
+		LENS_MODEL,
+		DICTIONARY_COLUMN_COUNT
+	};
+	
+	extern std::array <char const *, DICTIONARY_COLUMN_COUNT> const dictionary_column_names;
+	
+	// Joins image_record with the lookup tables. The column aliases match the image view, and
+	// image_record is available as r.
+	extern char const * const image_select_list;
+	extern char const * const image_from_clause;
+	
+	// Columns of image_record other than id, sequence_id and the dictionary-encoded ones.
+	extern char const * const image_record_value_columns;
+	
+	// Create the tables, the image view and the indices if needed. Databases that have
+	// the image table in the original flat form are converted.
+	void prepare_schema(sqlite::database &db);
+	
+	// Helpers for bulk loading.
+	void create_indices(sqlite::database &db);
+	void drop_indices(sqlite::database &db);
+	void create_filename_index(sqlite::database &db);	// Also created by create_indices().
+	void rebuild_full_text_index(sqlite::database &db);
+	void rebuild_similarity_index(sqlite::database &db);
+	
+	// The image_summary table has the columns dimension, value, image_count and total_bytes, the
+	// last being the size of the previews and the thumbnails. The dimensions are all (with the value
+	// zero), project, lens_model, model (the identifiers of the lookup table values), month (as
+	// YYYYMM) and rank. The table is maintained with triggers on image_record.
+	void create_summary_triggers(sqlite::database &db);
+	void drop_summary_triggers(sqlite::database &db);
+	void rebuild_summary(sqlite::database &db);
+	
+	// Add or remove the chunks of the given pHash to or from image_phash_chunk.
+	void add_to_similarity_index(sqlite::database &db, std::int64_t const image_id, std::uint64_t const phash);
+	void remove_from_similarity_index(sqlite::database &db, std::int64_t const image_id, std::uint64_t const phash);
+}
+
+#endif
@@ -0,0 +1,121 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "sequences.hh"
+
+
+namespace {
+	
+	struct sequence_entry
+	{
+		std::int64_t	id{};
+		std::int64_t	model_id{};
+		std::int64_t	timestamp{};		// Microseconds.
+		std::int64_t	sequence_id{};		// Zero if not assigned.
+		
+		bool operator<(sequence_entry const &other) const
+		{
+			return std::tie(model_id, timestamp, id) < std::tie(other.model_id, other.timestamp, other.id);
+		}
+	};
+}
+
+
+namespace index_images {
+	
+	void assign_sequences(sqlite::database &db, std::string const &directory, double const max_gap)
+	{
+		// List the images in the directory but not in its subdirectories. With a prefix, the range
+		// can be read from the filename index; '0' follows '/'.
+		auto const prefix(directory.empty() ? std::string() : directory + '/');
+		auto stmt(db << (
+			std::string("SELECT id, IFNULL(model_id, 0), IFNULL(timestamp_us, 0), IFNULL(sequence_id, 0), filename FROM image_record WHERE ")
+			+ (directory.empty() ? "instr(filename, '/') = 0;" : "filename > ? AND filename < ?;")
+		));
+		if (!directory.empty())
+			stmt << prefix << (directory + '0');
+		
+		std::vector <sequence_entry> entries;
+		stmt >> [&entries, &prefix](std::int64_t const id, std::int64_t const model_id, std::int64_t const timestamp, std::int64_t const sequence_id, std::string const &filename){
+			if (std::string::npos == filename.find('/', prefix.size()))
+				entries.push_back({id, model_id, timestamp, sequence_id});
+		};
+		
+		if (entries.empty())
+			return;
+		
+		std::sort(entries.begin(), entries.end());
+		
+		// Determine the first image of each sequence.
+		auto const max_gap_us(std::llround(max_gap * 1000000));
+		std::vector <std::size_t> sequence_starts;
+		for (std::size_t i(0); i < entries.size(); ++i)
+		{
+			auto const &entry(entries[i]);
+			auto const *prev(i ? &entries[i - 1] : nullptr);
+			if (
+				!prev ||
+				prev->model_id != entry.model_id ||
+				0 == prev->timestamp ||
+				0 == entry.timestamp ||
+				max_gap_us < entry.timestamp - prev->timestamp
+			)
+			{
+				sequence_starts.push_back(i);
+			}
+		}
+		
+		// An existing identifier may be reused if no image outside the directory has it, since
+		// all the images in the directory are updated below.
+		std::unordered_map <std::int64_t, std::int64_t> counts_in_directory;
+		for (auto const &entry : entries)
+		{
+			if (entry.sequence_id)
+				++counts_in_directory[entry.sequence_id];
+		}
+		
+		auto const is_reusable([&db, &counts_in_directory](std::int64_t const sequence_id){
+			std::int64_t count(0);
+			db << u8"SELECT COUNT(*) FROM image_record WHERE sequence_id = ?;" << sequence_id >> count;
+			return count == counts_in_directory[sequence_id];
+		});
+		
+		// Keep the identifier of the first image of each sequence when possible, so that running
+		// again does not change the identifiers of the unchanged sequences. The other sequences
+		// get new identifiers greater than the existing ones.
+		std::int64_t next_sequence_id(0);
+		db << u8"SELECT IFNULL(MAX(sequence_id), 0) FROM image_record;" >> next_sequence_id;
+		
+		std::unordered_set <std::int64_t> used_sequence_ids;
+		auto update_stmt(db << u8"UPDATE image_record SET sequence_id = ? WHERE id = ?;");
+		for (std::size_t i(0); i < sequence_starts.size(); ++i)
+		{
+			auto const begin(sequence_starts[i]);
+			auto const end(1 + i < sequence_starts.size() ? sequence_starts[1 + i] : entries.size());
+			
+			auto sequence_id(entries[begin].sequence_id);
+			if (!sequence_id || used_sequence_ids.count(sequence_id) || !is_reusable(sequence_id))
+				sequence_id = ++next_sequence_id;
+			used_sequence_ids.insert(sequence_id);
+			
+			for (auto j(begin); j < end; ++j)
+			{
+				auto const &entry(entries[j]);
+				if (entry.sequence_id == sequence_id)
+					continue;
+				
+				update_stmt << sequence_id << entry.id;
+				update_stmt.execute();
+			}
+		}
+	}
+}
@@ -0,0 +1,24 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_SEQUENCES_HH
+#define INDEX_IMAGES_SEQUENCES_HH
+
+#include <sqlite_modern_cpp.h>
+#include <string>
+
+
+namespace index_images {
+	
+	// Group the images directly in the given directory into bursts and sequences and store the
+	// identifiers in image_record.sequence_id. The images are ordered by the camera model and
+	// timestamp_us, and a new sequence is started when the model changes or when more than max_gap
+	// seconds have passed since the previous image. Images without a timestamp are not grouped.
+	// A sequence keeps the identifier of its first image if no other sequence has it, and the
+	// new identifiers are greater than the existing ones.
+	void assign_sequences(sqlite::database &db, std::string const &directory, double const max_gap);
+}
+
+#endif
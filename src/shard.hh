@@ -0,0 +1,60 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_SHARD_HH
+#define INDEX_IMAGES_SHARD_HH
+
+#include <cstdint>
+#include <cstdlib>
+#include <string_view>
+
+
+namespace index_images {
+	
+	// FNV-1a, used b.c. the result needs to be the same on every host.
+	inline std::uint64_t fnv1a_64(std::string_view const str)
+	{
+		std::uint64_t retval(0xcbf29ce484222325ULL);
+		for (auto const c : str)
+		{
+			retval ^= static_cast <unsigned char>(c);
+			retval *= 0x100000001b3ULL;
+		}
+		return retval;
+	}
+	
+	
+	// Partition of the image directories. Each directory belongs to exactly one shard.
+	struct shard_spec
+	{
+		std::uint32_t	index{};
+		std::uint32_t	count{1};
+		
+		// Parse “i/N” where 0 ≤ i < N.
+		bool parse(char const *spec)
+		{
+			char *end{};
+			auto const idx(std::strtoul(spec, &end, 10));
+			if (end == spec || '/' != *end)
+				return false;
+			
+			char const *count_str(end + 1);
+			auto const cc(std::strtoul(count_str, &end, 10));
+			if (end == count_str || '\0' != *end || 0 == cc || cc <= idx || UINT32_MAX < cc)
+				return false;
+			
+			index = idx;
+			count = cc;
+			return true;
+		}
+		
+		bool contains_directory(std::string_view const relative_path) const
+		{
+			return 1 == count || index == fnv1a_64(relative_path) % count;
+		}
+	};
+}
+
+#endif
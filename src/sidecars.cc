@@ -0,0 +1,142 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include <filesystem>
+#include "sidecars.hh"
+
+namespace fs	= std::filesystem;
+namespace ii	= index_images;
+
+
+namespace {
+	
+	std::string_view file_name(std::string_view const path)
+	{
+		auto const pos(path.find_last_of('/'));
+		return (std::string_view::npos == pos ? path : path.substr(1 + pos));
+	}
+	
+	
+	char to_lower(char const cc) { return ('A' <= cc && cc <= 'Z' ? cc - 'A' + 'a' : cc); }
+	
+	
+	// The names are compared case-insensitively, since the sidecars are found that way on
+	// case-insensitive file systems. On others, a false positive only causes a lookup.
+	bool is_less(std::string_view const lhs, std::string_view const rhs)
+	{
+		return std::lexicographical_compare(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](char const lhs, char const rhs){
+			return to_lower(lhs) < to_lower(rhs);
+		});
+	}
+	
+	
+	bool is_equal(std::string_view const lhs, std::string_view const rhs)
+	{
+		return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](char const lhs, char const rhs){
+			return to_lower(lhs) == to_lower(rhs);
+		});
+	}
+	
+	
+	bool has_extension(std::string_view const name, std::string_view const extension)
+	{
+		return extension.size() < name.size() && is_equal(name.substr(name.size() - extension.size()), extension);
+	}
+}
+
+
+namespace index_images {
+	
+	void directory_sidecars::add_entry(std::string_view const name)
+	{
+		if (has_extension(name, ".dop"))
+			m_entries.emplace_back(name.substr(0, name.size() - 4), SIDECAR_DOP);
+		else if (has_extension(name, ".xmp"))
+			m_entries.emplace_back(name.substr(0, name.size() - 4), SIDECAR_XMP);
+	}
+	
+	
+	// Sort the entries and combine the flags of each name.
+	void directory_sidecars::finish()
+	{
+		std::sort(m_entries.begin(), m_entries.end(), [](auto const &lhs, auto const &rhs){
+			return is_less(lhs.first, rhs.first);
+		});
+		
+		auto dst(m_entries.begin());
+		for (auto it(m_entries.begin()), end(m_entries.end()); it != end; ++it)
+		{
+			if (m_entries.begin() != dst && is_equal((dst - 1)->first, it->first))
+				(dst - 1)->second |= it->second;
+			else
+			{
+				if (dst != it)
+					*dst = std::move(*it);
+				++dst;
+			}
+		}
+		m_entries.erase(dst, m_entries.end());
+	}
+	
+	
+	std::uint8_t directory_sidecars::find(std::string_view const name) const
+	{
+		auto const it(std::lower_bound(m_entries.begin(), m_entries.end(), name, [](auto const &entry, auto const &name){
+			return is_less(entry.first, name);
+		}));
+		
+		if (m_entries.end() != it && is_equal(it->first, name))
+			return it->second;
+		return SIDECAR_NONE;
+	}
+	
+	
+	std::uint8_t directory_sidecars::flags(std::string_view const image_path) const
+	{
+		auto const name(file_name(image_path));
+		std::uint8_t retval(find(name));
+		
+		// Also check <image without the extension>.xmp.
+		auto const pos(name.find_last_of('.'));
+		if (std::string_view::npos != pos && 0 != pos)
+			retval |= (find(name.substr(0, pos)) & SIDECAR_XMP);
+		
+		return retval;
+	}
+	
+	
+	std::uint8_t sidecar_cache::flags(std::string_view const image_path)
+	{
+		auto const pos(image_path.find_last_of('/'));
+		auto const directory(std::string_view::npos == pos ? std::string_view(".") : image_path.substr(0, 1 + pos));
+		
+		if (directory != m_directory)
+		{
+			m_directory = directory;
+			m_sidecars.clear();
+			m_is_valid = false;
+			
+			std::error_code ec;
+			fs::directory_iterator it(m_directory, ec);
+			while (!ec && fs::directory_iterator() != it)
+			{
+				m_sidecars.add_entry(it->path().filename().u8string());
+				it.increment(ec);
+			}
+			
+			// Fall back to looking up each sidecar if the directory could not be listed.
+			if (ec)
+				m_sidecars.clear();
+			else
+			{
+				m_sidecars.finish();
+				m_is_valid = true;
+			}
+		}
+		
+		return (m_is_valid ? m_sidecars.flags(image_path) : SIDECAR_UNKNOWN);
+	}
+}
@@ -0,0 +1,68 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_SIDECARS_HH
+#define INDEX_IMAGES_SIDECARS_HH
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+
+namespace index_images {
+	
+	// Sidecar files next to an image, as a bit mask.
+	enum sidecar_flags : std::uint8_t
+	{
+		SIDECAR_NONE	= 0x0,
+		SIDECAR_DOP		= 0x1,	// <image>.dop
+		SIDECAR_XMP		= 0x2,	// <image>.xmp or <image without the extension>.xmp
+		SIDECAR_UNKNOWN	= 0x80	// Not discovered, i.e. the sidecars need to be looked up.
+	};
+	
+	
+	// Sidecars in one directory, determined from its entry names, so that the images need not
+	// be looked up one by one.
+	class directory_sidecars
+	{
+	protected:
+		typedef std::pair <std::string, std::uint8_t>	entry_type;	// Name without the sidecar extension, flags.
+		
+	protected:
+		std::vector <entry_type>	m_entries;	// Sorted by name after finish().
+		
+	public:
+		void clear() { m_entries.clear(); }
+		
+		// Add the directory entries one by one and call finish() before calling flags().
+		void add_entry(std::string_view const name);
+		void finish();
+		
+		// The directory part of the path is ignored.
+		std::uint8_t flags(std::string_view const image_path) const;
+		
+	protected:
+		std::uint8_t find(std::string_view const name) const;
+	};
+	
+	
+	// Lists the directory of the given image if the sidecars were not discovered while traversing,
+	// e.g. when the paths are read from a list. Consecutive images are usually in the same
+	// directory, so only the most recent directory is retained.
+	class sidecar_cache
+	{
+	protected:
+		std::string					m_directory;
+		directory_sidecars			m_sidecars;
+		bool						m_is_valid{};	// False if listing m_directory failed.
+		
+	public:
+		std::uint8_t flags(std::string_view const image_path);
+	};
+}
+
+#endif
@@ -0,0 +1,38 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <algorithm>
+#include "string_dictionary.hh"
+
+
+namespace index_images {
+	
+	void string_dictionary::load(sqlite::database &db, char const *column_name)
+	{
+		std::string const table_name(std::string("lookup_") + column_name);
+		
+		m_ids.clear();
+		m_next_id = 1;
+		m_insert_statement = "INSERT INTO " + table_name + " (id, value) VALUES (?, ?);";
+		
+		db << ("SELECT id, value FROM " + table_name + ";") >> [this](std::int64_t const id, std::string const &value){
+			m_ids.emplace(value, id);
+			m_next_id = std::max(m_next_id, 1 + id);
+		};
+	}
+	
+	
+	std::int64_t string_dictionary::id(sqlite::database &db, std::string const &value)
+	{
+		auto const it(m_ids.find(value));
+		if (m_ids.end() != it)
+			return it->second;
+		
+		auto const retval(m_next_id++);
+		db << m_insert_statement << retval << value;
+		m_ids.emplace(value, retval);
+		return retval;
+	}
+}
@@ -0,0 +1,40 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_STRING_DICTIONARY_HH
+#define INDEX_IMAGES_STRING_DICTIONARY_HH
+
+#include <cstdint>
+#include <sqlite_modern_cpp.h>
+#include <string>
+#include <unordered_map>
+
+
+namespace index_images {
+	
+	// In-memory copy of one lookup table. Identifiers are assigned here, so
+	// the table only needs to be written to when a new value is seen.
+	class string_dictionary
+	{
+	protected:
+		typedef std::unordered_map <std::string, std::int64_t>	map_type;
+		
+	protected:
+		map_type		m_ids;
+		std::string		m_insert_statement;
+		std::int64_t	m_next_id{1};
+		
+	public:
+		string_dictionary() = default;
+		
+		// Read the existing values from lookup_<column_name>.
+		void load(sqlite::database &db, char const *column_name);
+		
+		// Return the identifier of the given value, adding it to the table if needed.
+		std::int64_t id(sqlite::database &db, std::string const &value);
+	};
+}
+
+#endif
@@ -0,0 +1,163 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <boost/endian/conversion.hpp>
+#include <cstdint>
+#include <cstdio>
+
+// Does not use namespaces.
+#include <libraw/libraw.h>
+
+#include "libraw_exif_reader.hh"
+#include "tiff_walker.hh"
+
+
+namespace {
+	
+	namespace le = index_images::libraw_exif;
+	
+	
+	// Limits for damaged or malicious files.
+	constexpr std::size_t const max_ifd_count{16};
+	constexpr std::uint16_t const max_entry_count{1024};
+	
+	constexpr int const ifd_type{13};
+	constexpr int const exif_ifd_tag{0x8769};
+	constexpr int const gps_ifd_tag{0x8825};
+	
+	
+	class tiff_walker
+	{
+	protected:
+		LibRaw_abstract_datastream	&m_ds;
+		exif_parser_callback		m_callback{};
+		void						*m_context{};
+		std::uint16_t				m_order{};
+		
+	public:
+		tiff_walker(LibRaw_abstract_datastream &ds, exif_parser_callback callback, void *context):
+			m_ds(ds),
+			m_callback(callback),
+			m_context(context)
+		{
+		}
+		
+		bool walk();
+		
+	protected:
+		template <typename t_value>
+		bool read(t_value &value);
+		
+		bool seek(INT64 const offset) { return 0 == m_ds.seek(offset, SEEK_SET); }
+		bool walk_ifd(std::uint32_t const offset, int const tag_flags, std::uint32_t *next_offset);
+	};
+	
+	
+	template <typename t_value>
+	bool tiff_walker::read(t_value &value)
+	{
+		if (1 != m_ds.read(&value, sizeof(t_value), 1))
+			return false;
+		
+		if (0x4949 == m_order)
+			boost::endian::little_to_native_inplace(value);
+		else
+			boost::endian::big_to_native_inplace(value);
+		return true;
+	}
+	
+	
+	bool tiff_walker::walk()
+	{
+		if (!seek(0))
+			return false;
+		
+		// Byte order, then 42 or a vendor-specific magic number (e.g. “RO” in Olympus ORF).
+		std::uint16_t magic(0);
+		if (1 != m_ds.read(&m_order, sizeof(m_order), 1))
+			return false;
+		if (0x4949 != m_order && 0x4d4d != m_order)
+			return false;
+		if (!read(magic))
+			return false;
+		if (! (42 == magic || 0x4f52 == magic || 0x5352 == magic || 0x55 == magic))
+			return false;
+		
+		std::uint32_t offset(0);
+		if (!read(offset))
+			return false;
+		
+		// Follow the chain of top-level IFDs.
+		for (std::size_t i(0); offset && i < max_ifd_count; ++i)
+		{
+			std::uint32_t next_offset(0);
+			if (!walk_ifd(offset, (1 + i) << 20, &next_offset))
+				break;
+			offset = next_offset;
+		}
+		
+		return true;
+	}
+	
+	
+	// Report the entries of one IFD. Sub-IFDs are visited from the top-level IFDs only.
+	bool tiff_walker::walk_ifd(std::uint32_t const offset, int const tag_flags, std::uint32_t *next_offset)
+	{
+		std::uint16_t entry_count(0);
+		if (! (seek(offset) && read(entry_count)))
+			return false;
+		if (max_entry_count < entry_count)
+			return false;
+		
+		INT64 const first_entry_offset(offset + 2);
+		for (std::uint16_t i(0); i < entry_count; ++i)
+		{
+			INT64 const entry_offset(first_entry_offset + 12 * i);
+			std::uint16_t tag(0);
+			std::uint16_t type(0);
+			std::uint32_t count(0);
+			std::uint32_t value_offset(0);
+			
+			// The callback may have moved the stream.
+			if (! (seek(entry_offset) && read(tag) && read(type) && read(count) && read(value_offset)))
+				return false;
+			
+			auto const size(le::tiff_type_size(type));
+			if (!size)
+				continue;
+			
+			if (next_offset && (exif_ifd_tag == tag || gps_ifd_tag == tag) && (le::LONG == type || ifd_type == type))
+			{
+				walk_ifd(value_offset, (gps_ifd_tag == tag ? 0x50000 : 0), nullptr);
+				continue;
+			}
+			
+			// Values of at most four bytes are stored in the entry.
+			INT64 const data_offset(size * count <= 4 ? entry_offset + 8 : value_offset);
+			if (data_offset + size * count > m_ds.size() || !seek(data_offset))
+				continue;
+			
+			(*m_callback)(m_context, tag | tag_flags, type, count, m_order, &m_ds, 0);
+		}
+		
+		if (next_offset)
+		{
+			if (! (seek(first_entry_offset + 12 * entry_count) && read(*next_offset)))
+				*next_offset = 0;
+		}
+		
+		return true;
+	}
+}
+
+
+namespace index_images {
+	
+	bool walk_tiff(LibRaw_abstract_datastream &ds, exif_parser_callback callback, void *context)
+	{
+		tiff_walker walker(ds, callback, context);
+		return walker.walk();
+	}
+}
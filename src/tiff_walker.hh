@@ -0,0 +1,23 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_TIFF_WALKER_HH
+#define INDEX_IMAGES_TIFF_WALKER_HH
+
+// Does not use namespaces.
+#include <libraw/libraw.h>
+
+
+namespace index_images {
+	
+	// Visit the entries of the TIFF IFD chain and of the EXIF and GPS sub-IFDs without decoding
+	// anything else. The callback is called in the same way as LibRaw’s EXIF parser callback:
+	// the stream is positioned at the value, the entries of the nth top-level IFD are reported
+	// as tag | (n + 1) << 20, those of the EXIF IFD as the plain tag and those of the GPS IFD
+	// as tag | 0x50000. Returns false if the header could not be parsed.
+	bool walk_tiff(LibRaw_abstract_datastream &ds, exif_parser_callback callback, void *context);
+}
+
+#endif
@@ -0,0 +1,187 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <ctime>
+#include "work_claims.hh"
+
+
+namespace {
+	
+	enum work_item_state : std::uint8_t
+	{
+		PENDING = 0,
+		CLAIMED,
+		DONE
+	};
+	
+	enum discovery_state : std::uint8_t
+	{
+		NOT_STARTED = 0,
+		IN_PROGRESS,
+		FINISHED
+	};
+	
+	
+	std::int64_t current_time()
+	{
+		return std::time(nullptr);
+	}
+}
+
+
+namespace index_images {
+	
+	work_claims::work_claims(std::string const &path, std::string const &worker_id, std::uint32_t const lease_seconds):
+		m_db(path),
+		m_worker_id(worker_id),
+		m_lease_seconds(lease_seconds)
+	{
+		// Other processes may hold the lock for a while.
+		sqlite3_busy_timeout(m_db.connection().get(), 60000);
+		
+		m_db << u8""
+			"CREATE TABLE IF NOT EXISTS work_item (		"
+			"	id				INTEGER PRIMARY KEY,	"
+			"	path			TEXT NOT NULL UNIQUE,	"
+			"	state			INTEGER NOT NULL,		"
+			"	owner			TEXT,					"
+			"	claim			TEXT,					"
+			"	lease_expires	INTEGER					"
+			");											"
+		"";
+		m_db << u8"CREATE INDEX IF NOT EXISTS work_item_state ON work_item (state, lease_expires);";
+		m_db << u8"CREATE INDEX IF NOT EXISTS work_item_claim ON work_item (claim);";
+		
+		m_db << u8""
+			"CREATE TABLE IF NOT EXISTS discovery (					"
+			"	id				INTEGER PRIMARY KEY CHECK (id = 1),	"
+			"	state			INTEGER NOT NULL,					"
+			"	owner			TEXT,								"
+			"	lease_expires	INTEGER								"
+			");														"
+		"";
+		m_db << u8"INSERT OR IGNORE INTO discovery (id, state) VALUES (1, ?);" << NOT_STARTED;
+	}
+	
+	
+	std::int64_t work_claims::lease_expiry() const
+	{
+		return current_time() + m_lease_seconds;
+	}
+	
+	
+	bool work_claims::begin_discovery()
+	{
+		// Take over if the previous discoverer’s lease has expired.
+		m_db
+			<< u8"UPDATE discovery SET state = ?, owner = ?, lease_expires = ? WHERE id = 1 AND (state = ? OR (state = ? AND lease_expires < ?));"
+			<< IN_PROGRESS
+			<< m_worker_id
+			<< lease_expiry()
+			<< NOT_STARTED
+			<< IN_PROGRESS
+			<< current_time();
+		
+		int count(0);
+		m_db << u8"SELECT changes();" >> count;
+		return 0 < count;
+	}
+	
+	
+	void work_claims::add_paths(std::vector <std::string> const &paths)
+	{
+		m_db << u8"BEGIN IMMEDIATE;";
+		try
+		{
+			auto stmt(m_db << u8"INSERT OR IGNORE INTO work_item (path, state) VALUES (?, ?);");
+			stmt.used(true);
+			for (auto const &path : paths)
+			{
+				stmt << path << PENDING;
+				stmt.execute();
+			}
+			
+			m_db << u8"UPDATE discovery SET lease_expires = ? WHERE id = 1 AND owner = ?;" << lease_expiry() << m_worker_id;
+			m_db << u8"COMMIT;";
+		}
+		catch (...)
+		{
+			m_db << u8"ROLLBACK;";
+			throw;
+		}
+	}
+	
+	
+	void work_claims::end_discovery()
+	{
+		m_db << u8"UPDATE discovery SET state = ?, lease_expires = NULL WHERE id = 1 AND owner = ?;" << FINISHED << m_worker_id;
+	}
+	
+	
+	bool work_claims::is_discovery_finished()
+	{
+		int state(NOT_STARTED);
+		m_db << u8"SELECT state FROM discovery WHERE id = 1;" >> state;
+		return FINISHED == state;
+	}
+	
+	
+	bool work_claims::claim(std::size_t const count, std::vector <work_item> &items)
+	{
+		items.clear();
+		
+		// The claim is done with one statement, so no other process can claim the same items.
+		auto const claim(m_worker_id + '/' + std::to_string(m_claim_count++));
+		m_db
+			<< u8"UPDATE work_item SET state = ?, owner = ?, claim = ?, lease_expires = ? WHERE id IN ("
+			"SELECT id FROM work_item WHERE state = ? OR (state = ? AND lease_expires < ?) LIMIT ?"
+			");"
+			<< CLAIMED
+			<< m_worker_id
+			<< claim
+			<< lease_expiry()
+			<< PENDING
+			<< CLAIMED
+			<< current_time()
+			<< std::int64_t(count);
+		
+		m_db << u8"SELECT id, path FROM work_item WHERE claim = ?;" << claim >> [&items](std::int64_t const id, std::string const &path){
+			items.emplace_back(work_item{id, path});
+		};
+		
+		return !items.empty();
+	}
+	
+	
+	void work_claims::heartbeat()
+	{
+		m_db << u8"UPDATE work_item SET lease_expires = ? WHERE state = ? AND owner = ?;" << lease_expiry() << CLAIMED << m_worker_id;
+	}
+	
+	
+	void work_claims::mark_done(std::vector <std::int64_t> const &ids)
+	{
+		if (ids.empty())
+			return;
+		
+		m_db << u8"BEGIN IMMEDIATE;";
+		try
+		{
+			auto stmt(m_db << u8"UPDATE work_item SET state = ?, lease_expires = NULL WHERE id = ? AND owner = ?;");
+			stmt.used(true);
+			for (auto const id : ids)
+			{
+				stmt << DONE << id << m_worker_id;
+				stmt.execute();
+			}
+			m_db << u8"COMMIT;";
+		}
+		catch (...)
+		{
+			m_db << u8"ROLLBACK;";
+			throw;
+		}
+	}
+}
@@ -0,0 +1,61 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_WORK_CLAIMS_HH
+#define INDEX_IMAGES_WORK_CLAIMS_HH
+
+#include <cstdint>
+#include <sqlite_modern_cpp.h>
+#include <string>
+#include <vector>
+
+
+namespace index_images {
+	
+	struct work_item
+	{
+		std::int64_t	id{};
+		std::string		path;
+	};
+	
+	
+	// Shared table of image paths from which any number of indexer processes claim batches.
+	// A claim is valid until its lease expires; the lease is extended with heartbeat() while
+	// the process is alive. Items with an expired lease may be claimed by another process.
+	// The paths are discovered by one of the processes, which is also coordinated with a lease.
+	class work_claims
+	{
+	protected:
+		sqlite::database	m_db;
+		std::string			m_worker_id;
+		std::uint64_t		m_claim_count{};
+		std::uint32_t		m_lease_seconds{};
+		
+	public:
+		work_claims(std::string const &path, std::string const &worker_id, std::uint32_t const lease_seconds);
+		
+		std::string const &worker_id() const { return m_worker_id; }
+		std::uint32_t lease_seconds() const { return m_lease_seconds; }
+		
+		// Returns true if the calling process should discover the paths.
+		bool begin_discovery();
+		void add_paths(std::vector <std::string> const &paths);
+		void end_discovery();
+		bool is_discovery_finished();
+		
+		// Claim at most count items. Returns false if nothing could be claimed.
+		bool claim(std::size_t const count, std::vector <work_item> &items);
+		
+		// Extend the leases of the items claimed by this process.
+		void heartbeat();
+		
+		void mark_done(std::vector <std::int64_t> const &ids);
+		
+	protected:
+		std::int64_t lease_expiry() const;
+	};
+}
+
+#endif
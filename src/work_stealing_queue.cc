@@ -0,0 +1,73 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#include <libbio/assert.hh>
+#include "work_stealing_queue.hh"
+
+
+namespace index_images {
+	
+	work_stealing_queue::work_stealing_queue(std::size_t const worker_count)
+	{
+		libbio_assert_lt(0, worker_count);
+		m_deques.reserve(worker_count);
+		for (std::size_t i(0); i < worker_count; ++i)
+			m_deques.emplace_back(new worker_deque);
+	}
+	
+	
+	void work_stealing_queue::distribute(std::vector <scheduled_image> &&items)
+	{
+		// Deal the items so that each worker starts with one of the first ones. The size is updated
+		// under the same lock as the deque, so that a pop cannot decrement it before it has been
+		// incremented.
+		auto const count(m_deques.size());
+		for (std::size_t i(0); i < count; ++i)
+		{
+			auto &deque(*m_deques[i]);
+			std::lock_guard lock(deque.mutex);
+			auto const previous_size(deque.items.size());
+			for (std::size_t j(i); j < items.size(); j += count)
+				deque.items.emplace_back(std::move(items[j]));
+			m_size.fetch_add(deque.items.size() - previous_size, std::memory_order_release);
+		}
+	}
+	
+	
+	bool work_stealing_queue::pop(std::size_t const worker_idx, scheduled_image &item)
+	{
+		libbio_assert_lt(worker_idx, m_deques.size());
+		
+		// Own deque first.
+		{
+			auto &deque(*m_deques[worker_idx]);
+			std::lock_guard lock(deque.mutex);
+			if (!deque.items.empty())
+			{
+				item = std::move(deque.items.front());
+				deque.items.pop_front();
+				m_size.fetch_sub(1, std::memory_order_acq_rel);
+				return true;
+			}
+		}
+		
+		// Steal from the other workers.
+		auto const count(m_deques.size());
+		for (std::size_t i(1); i < count; ++i)
+		{
+			auto &deque(*m_deques[(worker_idx + i) % count]);
+			std::lock_guard lock(deque.mutex);
+			if (!deque.items.empty())
+			{
+				item = std::move(deque.items.back());
+				deque.items.pop_back();
+				m_size.fetch_sub(1, std::memory_order_acq_rel);
+				return true;
+			}
+		}
+		
+		return false;
+	}
+}
@@ -0,0 +1,66 @@
+/**
+ * Copyright (c) Tuukka Norri 2019
+ * This code is licensed under MIT license (see LICENSE for details).
+ */
+
+#ifndef INDEX_IMAGES_WORK_STEALING_QUEUE_HH
+#define INDEX_IMAGES_WORK_STEALING_QUEUE_HH
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "sidecars.hh"
+
+
+namespace index_images {
+	
+	struct scheduled_image
+	{
+		std::string		path;
+		std::uintmax_t	size{};
+		std::int64_t	mtime{};		// Unix time.
+		std::uint64_t	inode{};
+		std::int64_t	work_item_id{};	// Non-zero if claimed from the claims table.
+		std::uint8_t	sidecars{SIDECAR_UNKNOWN};	// See sidecar_flags.
+	};
+	
+	
+	// Per-worker deques of images. The items are dealt to the workers in the given order (see
+	// sort_images()), so that the workers together proceed from the first item to the last.
+	// A worker takes items from the front of its own deque and, when that is empty, steals
+	// from the back of the others’.
+	class work_stealing_queue
+	{
+	protected:
+		struct worker_deque
+		{
+			std::mutex						mutex;
+			std::deque <scheduled_image>	items;
+		};
+		
+		typedef std::vector <std::unique_ptr <worker_deque>>	deque_vector;
+		
+	protected:
+		deque_vector				m_deques;
+		std::atomic <std::size_t>	m_size{};
+		
+	public:
+		explicit work_stealing_queue(std::size_t const worker_count);
+		
+		std::size_t worker_count() const { return m_deques.size(); }
+		std::size_t size() const { return m_size.load(std::memory_order_acquire); }
+		bool empty() const { return 0 == size(); }
+		
+		// Deal the items to the workers.
+		void distribute(std::vector <scheduled_image> &&items);
+		
+		// Take the next item for the given worker. Returns false if all deques are empty.
+		bool pop(std::size_t const worker_idx, scheduled_image &item);
+	};
+}
+
+#endif